@@ -0,0 +1,321 @@
+/* Benchmark of the emulator and the transport protocol: runs a fixed set of
+   scenarios without tracing and reports how fast the simulator goes and how
+   well the protocol does.
+
+   usage: simbench [-n repeats] [-o results] [-b baseline] [-q engine] [-p] [scenario]...
+
+   Every scenario runs in a child process of its own, so the peak RSS
+   reported is that of the scenario alone, and is repeated -n times (3 by
+   default); the fastest repetition is reported.  The results are printed as
+   a table and, with -o, written one JSON object per line.  With -b the
+   simulator speed is compared against such a file from an earlier run.
+   Naming scenarios runs only those.  With -p every scenario is first run
+   recording its random decisions (see replay.h), and it is the replay of
+   that log, reading it included, that is timed; the protocol figures
+   are the same either way.  "copies" is the number of packets
+   copied whole, by the emulator and the transport, per message delivered.
+   The wide, aimd and vegas scenarios offer a load just below the channel's
+   capacity to a large window, without and with congestion control; their
+   p99 latencies show what filling the window costs.  narrow and reorder
+   run loss10's workload over the other channel models (see channel.c),
+   with their default parameters in both directions, and bursty over the
+   Gilbert-Elliott model with no loss but its bad spells'. */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "emulator.h"
+#include "evqueue.h"
+#include "cc.h"
+#include "channel.h"
+
+struct scenario
+{
+  const char *name;
+  int messages;
+  float loss;
+  float corrupt;
+  float lambda;
+  int bidirectional;
+  int coalesce;
+  int window;
+  int sendqueue;
+  int congestion;
+  int channel;
+};
+
+/* the canonical workloads */
+static const struct scenario scenarios[] = {
+    {"lossless", 1000000, 0.0, 0.0, 10.0, 0, 0, 0, 0, CC_NONE, CHM_IID},
+    {"loss10", 1000000, 0.1, 0.0, 10.0, 0, 0, 0, 0, CC_NONE, CHM_IID},
+    {"loss30", 1000000, 0.3, 0.0, 10.0, 0, 0, 0, 0, CC_NONE, CHM_IID},
+    {"corrupt", 1000000, 0.0, 0.3, 10.0, 0, 0, 0, 0, CC_NONE, CHM_IID},
+    {"large", 10000000, 0.0, 0.0, 10.0, 0, 0, 0, 0, CC_NONE, CHM_IID},
+    {"duplex", 1000000, 0.1, 0.0, 10.0, 1, 0, 0, 0, CC_NONE, CHM_IID},
+    {"fast", 1000000, 0.1, 0.0, 1.0, 0, 0, 0, 0, CC_NONE, CHM_IID},
+    {"coalesce", 1000000, 0.1, 0.0, 1.0, 0, MAXCOALESCE, 0, 0, CC_NONE, CHM_IID},
+    {"wide", 1000000, 0.02, 0.0, 6.5, 0, 0, 64, -1, CC_NONE, CHM_IID},
+    {"aimd", 1000000, 0.02, 0.0, 6.5, 0, 0, 64, -1, CC_AIMD, CHM_IID},
+    {"vegas", 1000000, 0.02, 0.0, 6.5, 0, 0, 64, -1, CC_VEGAS, CHM_IID},
+    {"bursty", 1000000, 0.0, 0.0, 10.0, 0, 0, 0, 0, CC_NONE, CHM_GILBERT},
+    {"narrow", 1000000, 0.1, 0.0, 10.0, 0, 0, 0, 0, CC_NONE, CHM_BANDWIDTH},
+    {"reorder", 1000000, 0.1, 0.0, 10.0, 0, 0, 0, 0, CC_NONE, CHM_REORDER},
+};
+#define NSCENARIOS ((int)(sizeof(scenarios) / sizeof(scenarios[0])))
+
+/* what one run of a scenario measured */
+struct result
+{
+  double seconds;
+  long maxrss; /* KiB */
+  long long events;
+  int delivered;
+  double goodput;
+  double retxratio;
+  double p50, p99;
+  double simtime;
+  double copies; /* packet copies per message delivered */
+};
+
+static double now(void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/* simulate the scenario in this process */
+static void runscenario(const struct scenario *sc, int evqengine, int replay, struct result *res)
+{
+  struct sim_config cfg;
+  struct sim_stats *st;
+  struct rusage ru;
+  struct sim *sim;
+  FILE *log = NULL;
+  double t0;
+
+  sim_defaults(&cfg);
+  cfg.nsimmax = sc->messages;
+  cfg.lossprob = sc->loss;
+  cfg.corruptprob = sc->corrupt;
+  cfg.corruptdirection = 2;
+  cfg.lambda = sc->lambda;
+  cfg.bidirectional = sc->bidirectional;
+  cfg.coalesce = sc->coalesce;
+  cfg.windowsize = sc->window;
+  cfg.sendqueue = sc->sendqueue;
+  cfg.congestion = sc->congestion;
+  cfg.channel[A].model = sc->channel;
+  cfg.channel[B].model = sc->channel;
+  cfg.trace = 0;
+  cfg.evqengine = evqengine;
+
+  if (replay)
+  {
+    cfg.record = 1;
+    sim = sim_create(&cfg);
+    if (sim == NULL || (log = tmpfile()) == NULL)
+      exit(EXIT_FAILURE);
+    sim_run(sim);
+    if (sim_writelog(sim, log) != 0)
+      exit(EXIT_FAILURE);
+    sim_destroy(sim);
+    rewind(log);
+    cfg.record = 0;
+    cfg.replay = log;
+  }
+
+  memset(res, 0, sizeof(*res));
+  t0 = now();
+  sim = sim_create(&cfg);
+  if (sim == NULL)
+    exit(EXIT_FAILURE);
+  sim_run(sim);
+  res->seconds = now() - t0;
+  st = sim_stats(sim);
+  res->events = st->nevents;
+  res->delivered = st->messages_delivered;
+  res->goodput = st->goodput;
+  res->retxratio = st->retxratio;
+  res->p50 = st->latency[B].p50;
+  res->p99 = st->latency[B].p99;
+  res->simtime = st->time;
+  res->copies = st->messages_delivered > 0 ? (double)st->pktcopies / st->messages_delivered : 0.0;
+  sim_destroy(sim);
+  if (log != NULL)
+    fclose(log);
+  getrusage(RUSAGE_SELF, &ru);
+  res->maxrss = ru.ru_maxrss;
+}
+
+/* run the scenario in a child process, 0 on success */
+static int forkscenario(const struct scenario *sc, int evqengine, int replay, struct result *res)
+{
+  int fd[2], status;
+  pid_t pid;
+  ssize_t n;
+
+  if (pipe(fd) != 0)
+  {
+    perror("pipe");
+    return -1;
+  }
+  fflush(stdout);
+  pid = fork();
+  if (pid < 0)
+  {
+    perror("fork");
+    return -1;
+  }
+  if (pid == 0)
+  {
+    close(fd[0]);
+    runscenario(sc, evqengine, replay, res);
+    n = write(fd[1], res, sizeof(*res));
+    _exit(n == (ssize_t)sizeof(*res) ? EXIT_SUCCESS : EXIT_FAILURE);
+  }
+  close(fd[1]);
+  n = read(fd[0], res, sizeof(*res));
+  close(fd[0]);
+  waitpid(pid, &status, 0);
+  if (n != (ssize_t)sizeof(*res) || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+  {
+    fprintf(stderr, "scenario %s failed\n", sc->name);
+    return -1;
+  }
+  return 0;
+}
+
+/* ns/event of the scenario in a results file written with -o, 0 if absent */
+static double baseline(const char *path, const char *name)
+{
+  char line[1024], key[64];
+  double nsperevent;
+  FILE *fp = fopen(path, "r");
+
+  if (fp == NULL)
+    return 0.0;
+  snprintf(key, sizeof(key), "\"scenario\": \"%s\"", name);
+  while (fgets(line, sizeof(line), fp) != NULL)
+  {
+    const char *p = strstr(line, "\"ns_per_event\": ");
+    if (strstr(line, key) != NULL && p != NULL && sscanf(p + 16, "%lf", &nsperevent) == 1)
+    {
+      fclose(fp);
+      return nsperevent;
+    }
+  }
+  fclose(fp);
+  return 0.0;
+}
+
+static void usage(const char *prog)
+{
+  int i;
+
+  fprintf(stderr, "usage: %s [-n repeats] [-o results] [-b baseline] [-q engine] [-p] [scenario]...\n", prog);
+  fprintf(stderr, "scenarios:");
+  for (i = 0; i < NSCENARIOS; i++)
+    fprintf(stderr, " %s", scenarios[i].name);
+  fprintf(stderr, "\n");
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+  const char *outpath = NULL, *basepath = NULL;
+  struct result best, res;
+  int selected[NSCENARIOS];
+  int repeats = 3, evqengine, replay = 0, i, k, opt, nselected = 0;
+  double nsperevent, base;
+  FILE *out = NULL;
+
+  memset(&best, 0, sizeof(best));
+  evqengine = EVQ_HEAP;
+  while ((opt = getopt(argc, argv, "n:o:b:q:p")) != -1)
+  {
+    switch (opt)
+    {
+    case 'n':
+      repeats = atoi(optarg);
+      break;
+    case 'o':
+      outpath = optarg;
+      break;
+    case 'b':
+      basepath = optarg;
+      break;
+    case 'q':
+      if ((evqengine = evq_engine(optarg)) < 0)
+        usage(argv[0]);
+      break;
+    case 'p':
+      replay = 1;
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  for (i = 0; i < NSCENARIOS; i++)
+    selected[i] = optind == argc;
+  for (k = optind; k < argc; k++)
+  {
+    for (i = 0; i < NSCENARIOS; i++)
+      if (strcmp(argv[k], scenarios[i].name) == 0)
+        break;
+    if (i == NSCENARIOS)
+      usage(argv[0]);
+    selected[i] = 1;
+  }
+  if (repeats < 1)
+    repeats = 1;
+  if (outpath != NULL && (out = fopen(outpath, "w")) == NULL)
+  {
+    perror(outpath);
+    return EXIT_FAILURE;
+  }
+
+  printf("%-10s %10s %9s %10s %9s %9s %9s %8s %8s %8s %7s%s\n", "scenario", "events", "seconds",
+         "events/s", "ns/event", "rss(KiB)", "delivered", "goodput", "retx", "p99", "copies",
+         basepath != NULL ? "  vs baseline" : "");
+  for (i = 0; i < NSCENARIOS; i++)
+  {
+    if (!selected[i])
+      continue;
+    nselected++;
+    for (k = 0; k < repeats; k++)
+    {
+      if (forkscenario(&scenarios[i], evqengine, replay, &res) != 0)
+        return EXIT_FAILURE;
+      if (k == 0 || res.seconds < best.seconds)
+        best = res;
+    }
+    nsperevent = best.events > 0 ? best.seconds * 1e9 / best.events : 0.0;
+    printf("%-10s %10lld %9.3f %10.0f %9.1f %9ld %9d %8.4f %8.4f %8.3f %7.3f", scenarios[i].name,
+           best.events, best.seconds, best.seconds > 0.0 ? best.events / best.seconds : 0.0,
+           nsperevent, best.maxrss, best.delivered, best.goodput, best.retxratio, best.p99,
+           best.copies);
+    if (basepath != NULL && (base = baseline(basepath, scenarios[i].name)) > 0.0)
+      printf("  %+.1f%%", 100.0 * (nsperevent - base) / base);
+    printf("\n");
+    if (out != NULL)
+      fprintf(out, "{\"scenario\": \"%s\", \"messages\": %d, \"loss\": %g, \"corrupt\": %g, "
+                   "\"lambda\": %g, \"bidirectional\": %d, \"coalesce\": %d, \"window\": %d, \"congestion\": %d, \"channel\": %d, \"events\": %lld, \"seconds\": %f, \"events_per_sec\": %f, "
+                   "\"ns_per_event\": %f, \"maxrss_kib\": %ld, \"simtime\": %f, \"delivered\": %d, "
+                   "\"goodput\": %f, \"retxratio\": %f, \"latency_p50\": %f, \"latency_p99\": %f, "
+                   "\"copies_per_message\": %f}\n",
+              scenarios[i].name, scenarios[i].messages, scenarios[i].loss, scenarios[i].corrupt,
+              scenarios[i].lambda, scenarios[i].bidirectional, scenarios[i].coalesce,
+              scenarios[i].window, scenarios[i].congestion, scenarios[i].channel, best.events, best.seconds,
+              best.seconds > 0.0 ? best.events / best.seconds : 0.0, nsperevent, best.maxrss,
+              best.simtime, best.delivered, best.goodput, best.retxratio, best.p50, best.p99,
+              best.copies);
+  }
+  if (out != NULL)
+    fclose(out);
+  return nselected > 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
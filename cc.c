@@ -0,0 +1,105 @@
+/* Congestion control for the transport sender.
+
+   aimd:  TCP Reno's window rules.  The window starts at INITWND packets
+          and grows by one packet per packet ACKed (slow start) up to
+          ssthresh, then by one packet per window's worth of ACKs.  A loss
+          halves it, into ssthresh; a timeout also drops it to one packet,
+          so that slow start begins again.
+   vegas: TCP Vegas's.  Once per round trip the packets queued in the
+          channel are estimated as cwnd * (1 - basertt / rtt), where rtt
+          is the mean round trip time of the last round trip and basertt
+          the least such mean seen.  (Vegas proper takes the least sample
+          of each, but the emulator's channel delays every packet by a
+          random 1 to 10 time units, so that the least samples are mostly
+          jitter and the estimate stays high whatever the queue.)  Slow
+          start ends when more than GAMMA packets are queued;
+          after that the window grows by one packet per round trip while
+          fewer than ALPHA are and shrinks by one while more than BETA
+          are.  Losses are handled as by aimd.
+
+   With none the window stays at the sender's window. */
+#include <string.h>
+#include "cc.h"
+
+#define INITWND 2.0 /* initial window */
+#define MINSSTHRESH 2.0
+#define ALPHA 2.0   /* Vegas: fewest packets to keep queued */
+#define BETA 4.0    /* Vegas: most packets to keep queued */
+#define GAMMA 1.0   /* Vegas: packets queued that end slow start */
+
+static const char *cc_names[CC_NKINDS] = {"none", "aimd", "vegas"};
+
+int cc_kind(const char *name)
+{
+  int i;
+  for (i = 0; i < CC_NKINDS; i++)
+    if (strcmp(name, cc_names[i]) == 0)
+      return i;
+  return -1;
+}
+
+/* keep the window within [1, maxwnd] */
+static void clamp(struct cc *cc)
+{
+  if (cc->cwnd > cc->maxwnd)
+    cc->cwnd = cc->maxwnd;
+  if (cc->cwnd < 1.0)
+    cc->cwnd = 1.0;
+}
+
+void cc_init(struct cc *cc, int kind, int maxwnd)
+{
+  memset(cc, 0, sizeof(*cc));
+  cc->kind = kind;
+  cc->maxwnd = maxwnd;
+  cc->cwnd = kind == CC_NONE ? maxwnd : INITWND;
+  cc->ssthresh = maxwnd;
+  clamp(cc);
+}
+
+void cc_ack(struct cc *cc, int acked, double now)
+{
+  double queued, rtt;
+
+  if (cc->kind == CC_NONE)
+    return;
+  if (cc->kind == CC_VEGAS && cc->epochsamples > 0 && now >= cc->epochend)
+  {
+    rtt = cc->epochrtt / cc->epochsamples;
+    if (cc->basertt == 0.0 || rtt < cc->basertt)
+      cc->basertt = rtt;
+    queued = cc->cwnd * (1.0 - cc->basertt / rtt);
+    if (cc->cwnd < cc->ssthresh)
+    {
+      if (queued > GAMMA)
+        cc->ssthresh = cc->cwnd;
+    }
+    else if (queued < ALPHA)
+      cc->cwnd += 1.0;
+    else if (queued > BETA)
+      cc->cwnd -= 1.0;
+    cc->epochend = now + rtt;
+    cc->epochrtt = 0.0;
+    cc->epochsamples = 0;
+  }
+  if (cc->cwnd < cc->ssthresh)
+    cc->cwnd += acked;
+  else if (cc->kind == CC_AIMD)
+    cc->cwnd += acked / cc->cwnd;
+  clamp(cc);
+}
+
+void cc_rtt(struct cc *cc, double rtt)
+{
+  cc->epochrtt += rtt;
+  cc->epochsamples++;
+}
+
+void cc_loss(struct cc *cc, int timeout)
+{
+  if (cc->kind == CC_NONE)
+    return;
+  cc->ssthresh = cc->cwnd / 2 > MINSSTHRESH ? cc->cwnd / 2 : MINSSTHRESH;
+  cc->cwnd = timeout ? 1.0 : cc->ssthresh;
+  clamp(cc);
+}
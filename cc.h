@@ -0,0 +1,47 @@
+/* congestion control for a transport sender.  The congestion window     */
+/* (cwnd) bounds the packets in flight below the sender's own window, and */
+/* adapts to the losses and round trip times the sender observes.        */
+
+#define CC_NONE 0  /* no congestion control: the window alone limits */
+#define CC_AIMD 1  /* slow start, then additive increase and multiplicative */
+                   /* decrease on loss (Reno) */
+#define CC_VEGAS 2 /* the same response to loss, but once past slow start */
+                   /* grows or shrinks by one packet per round trip to keep */
+                   /* a few packets queued in the channel (Vegas) */
+#define CC_NKINDS 3
+
+struct cc
+{
+  int kind;        /* one of CC_* */
+  double cwnd;     /* packets that may be in flight */
+  double ssthresh; /* slow start while cwnd is below this */
+  double maxwnd;   /* the sender's window, which cwnd never exceeds */
+  double basertt;  /* Vegas: least mean round trip time seen, 0 before any */
+  double epochrtt; /* Vegas: round trip times measured this round trip, summed */
+  int epochsamples; /* Vegas: and their number */
+  double epochend; /* Vegas: when the current round trip is over */
+};
+
+/* map a congestion control name ("none", "aimd", "vegas") to CC_*, -1 */
+/* if unknown */
+extern int cc_kind(const char *name);
+
+/* start with the initial window, for a sender whose window is maxwnd */
+extern void cc_init(struct cc *, int kind, int maxwnd);
+
+/* acked packets were newly ACKed at time now */
+extern void cc_ack(struct cc *, int acked, double now);
+
+/* a round trip time was measured */
+extern void cc_rtt(struct cc *, double rtt);
+
+/* a packet was lost, found by its retransmission timer if timeout is */
+/* set and by later packets' ACKs otherwise; call once per window of */
+/* data at most */
+extern void cc_loss(struct cc *, int timeout);
+
+/* packets that may be in flight now */
+static inline int cc_window(const struct cc *cc)
+{
+  return (int)cc->cwnd;
+}
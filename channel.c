@@ -0,0 +1,226 @@
+/* Channel models for the network emulator (see channel.h).
+
+   - iid:       the original channel.  A packet is lost with the run's loss
+                probability, and arrives 1 to 10 time units (uniformly)
+                after the packet ahead of it, or after being sent if the
+                channel is empty, so packets queue up behind each other
+                and never overtake.
+   - gilbert:   the Gilbert-Elliott channel.  Before every packet a good
+                channel turns bad with probability pgb and a bad one good
+                with probability pbg, so bad spells last 1 / pbg packets
+                on average; a packet is lost with the run's loss
+                probability while good and with lossbad while bad.
+                Delays as iid.
+   - bandwidth: a link that serializes rate bytes per time unit.  A packet
+                waits for the link to finish with the packets ahead of it,
+                takes PKT_SIZE / rate to serialize and then the propagation
+                delay to arrive, so delay grows with the bytes queued
+                rather than at random.  Loss as iid.
+   - reorder:   as iid, but with probability reorder a packet is held back
+                by up to REORDERDELAY more time units without holding up
+                the packets behind it, which may then overtake it.
+
+   A parameter left CHAN_DEFAULT takes the default below. */
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "emulator.h"
+#include "channel.h"
+#include "rng.h"
+
+#define PGB 0.01           /* gilbert: chance of a good channel turning bad */
+#define PBG 0.25           /* gilbert: chance of a bad channel turning good */
+#define LOSSBAD 1.0        /* gilbert: loss probability while bad */
+#define RATE 8.0           /* bandwidth: bytes per time unit */
+#define PROPDELAY 1.0      /* bandwidth: propagation delay */
+#define REORDER 0.05       /* reorder: chance a packet is held back */
+#define REORDERDELAY 10.0  /* reorder: most time units it is held back by */
+
+/* a span of simulated time, in ticks, rounded as the emulator does */
+static int64_t ticks(double units)
+{
+  return (int64_t)(units * TICKS_PER_UNIT + 0.5);
+}
+
+/*********************** IID ************************/
+
+static int iid_lose(struct chanmodel *m, struct rng *r)
+{
+  return rng_uniform(r) < m->lossprob;
+}
+
+/* 1 to 10 time units after the packet ahead */
+static void iid_delays(struct chanmodel *m, struct rng *r, struct chandelay *d)
+{
+  (void)m;
+  d->gap = ticks(1 + 9 * rng_uniform(r));
+  d->holdback = 0;
+}
+
+/* queued behind the packet ahead, unless held back */
+static int64_t fifo_arrival(struct chanmodel *m, const struct chandelay *d, int64_t now, int bytes)
+{
+  int64_t lastime = m->lastarrival > now ? m->lastarrival : now;
+
+  (void)bytes;
+  m->lastarrival = lastime + d->gap;
+  return m->lastarrival + d->holdback;
+}
+
+/*********************** GILBERT ********************/
+
+static int gilbert_lose(struct chanmodel *m, struct rng *r)
+{
+  if (rng_uniform(r) < (m->bad ? m->spec.pbg : m->spec.pgb))
+    m->bad = !m->bad;
+  return rng_uniform(r) < (m->bad ? m->spec.lossbad : m->lossprob);
+}
+
+/*********************** BANDWIDTH ******************/
+
+static void bandwidth_delays(struct chanmodel *m, struct rng *r, struct chandelay *d)
+{
+  (void)m;
+  (void)r;
+  d->gap = 0;
+  d->holdback = 0;
+}
+
+static int64_t bandwidth_arrival(struct chanmodel *m, const struct chandelay *d, int64_t now, int bytes)
+{
+  if (m->busyuntil < now)
+    m->busyuntil = now;
+  m->busyuntil += ticks(bytes / m->spec.rate);
+  m->lastarrival = m->busyuntil + ticks(m->spec.delay);
+  return m->lastarrival + d->holdback;
+}
+
+/*********************** REORDER ********************/
+
+static void reorder_delays(struct chanmodel *m, struct rng *r, struct chandelay *d)
+{
+  iid_delays(m, r, d);
+  if (rng_uniform(r) < m->spec.reorder)
+    d->holdback = ticks(REORDERDELAY * rng_uniform(r));
+}
+
+/********************* MODEL TABLE ******************/
+
+static const struct chan_ops chan_models[CHM_NMODELS] = {
+    {"iid", iid_lose, iid_delays, fifo_arrival},
+    {"gilbert", gilbert_lose, iid_delays, fifo_arrival},
+    {"bandwidth", iid_lose, bandwidth_delays, bandwidth_arrival},
+    {"reorder", iid_lose, reorder_delays, fifo_arrival},
+};
+
+int chan_model(const char *name)
+{
+  int i;
+  for (i = 0; i < CHM_NMODELS; i++)
+    if (strcmp(name, chan_models[i].name) == 0)
+      return i;
+  return -1;
+}
+
+const char *chan_name(int model)
+{
+  return model >= 0 && model < CHM_NMODELS ? chan_models[model].name : "?";
+}
+
+void chan_spec(struct chanspec *spec, int model)
+{
+  spec->model = model;
+  spec->pgb = CHAN_DEFAULT;
+  spec->pbg = CHAN_DEFAULT;
+  spec->lossbad = CHAN_DEFAULT;
+  spec->rate = CHAN_DEFAULT;
+  spec->delay = CHAN_DEFAULT;
+  spec->reorder = CHAN_DEFAULT;
+}
+
+int chan_parse(const char *text, struct chanspec *spec)
+{
+  char name[32];
+  double p[3] = {CHAN_DEFAULT, CHAN_DEFAULT, CHAN_DEFAULT};
+  const char *s;
+  char *end;
+  int model, n = 0;
+
+  s = strchr(text, ':');
+  if (s == NULL)
+    s = text + strlen(text);
+  if (s - text >= (int)sizeof(name))
+    return -1;
+  memcpy(name, text, s - text);
+  name[s - text] = '\0';
+  if ((model = chan_model(name)) < 0)
+    return -1;
+  chan_spec(spec, model);
+  while (*s != '\0')
+  {
+    if (n == 3)
+      return -1;
+    p[n] = strtod(s + 1, &end);
+    if (end == s + 1 || (*end != ',' && *end != '\0') || !(p[n++] >= 0.0))
+      return -1;
+    s = end;
+  }
+  switch (spec->model)
+  {
+  case CHM_GILBERT:
+    spec->pgb = p[0];
+    spec->pbg = p[1];
+    spec->lossbad = p[2];
+    break;
+  case CHM_BANDWIDTH:
+    spec->rate = p[0];
+    spec->delay = p[1];
+    return n > 2 ? -1 : 0;
+  case CHM_REORDER:
+    spec->reorder = p[0];
+    return n > 1 ? -1 : 0;
+  default:
+    return n > 0 ? -1 : 0;
+  }
+  return 0;
+}
+
+/* true if a parameter is neither CHAN_DEFAULT nor within [least, most] */
+static int outside(double param, double least, double most)
+{
+  return param != CHAN_DEFAULT && !(param >= least && param <= most);
+}
+
+const char *chan_checkspec(const struct chanspec *spec)
+{
+  if (spec->model < 0 || spec->model >= CHM_NMODELS)
+    return "unknown channel model";
+  if (outside(spec->pgb, 0.0, 1.0) || outside(spec->pbg, 0.0, 1.0) ||
+      outside(spec->lossbad, 0.0, 1.0) || outside(spec->reorder, 0.0, 1.0))
+    return "a channel model's probabilities must be between 0 and 1";
+  if (outside(spec->rate, 0.0, HUGE_VAL) || spec->rate == 0.0)
+    return "a bandwidth channel's rate must be more than 0";
+  if (outside(spec->delay, 0.0, HUGE_VAL))
+    return "a bandwidth channel's delay must not be negative";
+  return NULL;
+}
+
+void chan_init(struct chanmodel *m, const struct chanspec *spec, double lossprob)
+{
+  memset(m, 0, sizeof(*m));
+  m->spec = *spec;
+  m->ops = &chan_models[m->spec.model];
+  m->lossprob = lossprob;
+  if (m->spec.pgb == CHAN_DEFAULT)
+    m->spec.pgb = PGB;
+  if (m->spec.pbg == CHAN_DEFAULT)
+    m->spec.pbg = PBG;
+  if (m->spec.lossbad == CHAN_DEFAULT)
+    m->spec.lossbad = LOSSBAD;
+  if (m->spec.rate == CHAN_DEFAULT)
+    m->spec.rate = RATE;
+  if (m->spec.delay == CHAN_DEFAULT)
+    m->spec.delay = PROPDELAY;
+  if (m->spec.reorder == CHAN_DEFAULT)
+    m->spec.reorder = REORDER;
+}
@@ -0,0 +1,89 @@
+/* channel models: what happens to the packets sent in one direction of   */
+/* the emulated channel.  A model decides which packets are lost on top   */
+/* of the run's i.i.d. loss and when the others arrive; corruption stays  */
+/* i.i.d. whatever the model.  Each direction has a model of its own.     */
+/* The random part of a packet's delay is drawn apart from the arrival   */
+/* time it leads to, so that a replayed run (see replay.h) can give the  */
+/* model the draws of the run it recorded.                                */
+#include <stdint.h>
+
+#define CHM_IID 0       /* the original: delay uniform on [1, 10] after the */
+                        /* previous packet's arrival, never reordered */
+#define CHM_GILBERT 1   /* Gilbert-Elliott bursty loss: the channel turns bad */
+                        /* and good again at random, and loses more while bad */
+#define CHM_BANDWIDTH 2 /* a link of finite rate: a packet waits until those */
+                        /* ahead of it are serialized, takes PKT_SIZE / rate */
+                        /* itself and then a fixed propagation delay */
+#define CHM_REORDER 3   /* as iid, but some packets are held back so that */
+                        /* later ones overtake them */
+#define CHM_NMODELS 4
+
+struct rng;
+
+/* the random part of one packet's delay, in ticks */
+struct chandelay
+{
+  int64_t gap;      /* after the packet ahead, or after being sent if none */
+  int64_t holdback; /* more, without holding up the packets behind */
+};
+
+/* state of one direction's model */
+struct chanmodel
+{
+  const struct chan_ops *ops;
+  struct chanspec spec;  /* parameters, defaults filled in */
+  double lossprob;       /* i.i.d. loss in this direction (0 if not lossy) */
+  int bad;               /* gilbert: the channel is bad */
+  int64_t lastarrival;   /* arrival time of the last packet not held back */
+  int64_t busyuntil;     /* bandwidth: when the link is done serializing */
+};
+
+struct chan_ops
+{
+  const char *name;
+  int (*lose)(struct chanmodel *, struct rng *);
+  void (*delays)(struct chanmodel *, struct rng *, struct chandelay *);
+  int64_t (*arrival)(struct chanmodel *, const struct chandelay *, int64_t now, int bytes);
+};
+
+/* map a model name ("iid", "gilbert", "bandwidth", "reorder") to CHM_*, */
+/* -1 if unknown */
+extern int chan_model(const char *name);
+
+/* name of model CHM_* */
+extern const char *chan_name(int model);
+
+/* fill in spec for the given model with every parameter CHAN_DEFAULT */
+extern void chan_spec(struct chanspec *spec, int model);
+
+/* parse a model given as name[:param,...] into spec, 0 on success.  The */
+/* parameters, all optional, are gilbert:pgb,pbg,lossbad,               */
+/* bandwidth:rate,delay and reorder:reorder (see struct chanspec).       */
+extern int chan_parse(const char *text, struct chanspec *spec);
+
+/* NULL if spec is one chan_init can set up, else what is wrong with it */
+extern const char *chan_checkspec(const struct chanspec *spec);
+
+/* set up the model of a direction whose i.i.d. loss probability is */
+/* lossprob; spec must pass chan_checkspec, and its parameters left */
+/* CHAN_DEFAULT take their defaults                                 */
+extern void chan_init(struct chanmodel *, const struct chanspec *spec, double lossprob);
+
+/* true if the next packet is to be lost */
+static inline int chan_lose(struct chanmodel *m, struct rng *r)
+{
+  return m->ops->lose(m, r);
+}
+
+/* draw the random part of the delay of a packet that is not lost */
+static inline void chan_delays(struct chanmodel *m, struct rng *r, struct chandelay *d)
+{
+  m->ops->delays(m, r, d);
+}
+
+/* arrival time, in ticks, of a packet of the given size sent at now */
+/* with the given delays */
+static inline int64_t chan_arrival(struct chanmodel *m, const struct chandelay *d, int64_t now, int bytes)
+{
+  return m->ops->arrival(m, d, now, bytes);
+}
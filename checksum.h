@@ -0,0 +1,34 @@
+/* checksum engines the transport protocol can protect its packets with.  */
+/* Each covers a packet's seqnum, acknum and the length bytes of payload  */
+/* in use, and all but legacy the length itself, i.e. all of the packet   */
+/* but the checksum field.  They read the packet through a const pointer. */
+#include <stdint.h>
+#include <stddef.h>
+
+#define CK_LEGACY 0 /* the original sum of seqnum, acknum and payload bytes */
+#define CK_INET 1   /* Internet checksum: 16-bit ones' complement sum (RFC 1071) */
+#define CK_CRC32C 2 /* CRC-32C (Castagnoli), slicing-by-8 */
+#define CK_NENGINES 3
+
+struct pkt;
+
+typedef int checksum_fn(const struct pkt *);
+
+/* map an engine name ("legacy", "inet", "crc32c") to CK_*, -1 if unknown */
+extern int checksum_engine(const char *name);
+
+/* name of engine CK_* */
+extern const char *checksum_name(int engine);
+
+/* the function that computes engine CK_*'s checksum of a packet */
+extern checksum_fn *checksum_func(int engine);
+
+extern int checksum_legacy(const struct pkt *);
+extern int checksum_inet(const struct pkt *);
+extern int checksum_crc32c(const struct pkt *);
+
+/* the same over any bytes: ones' complement sum of the big-endian 16-bit */
+/* words (a trailing odd byte padded with zero), before the final fold    */
+/* and complement, and CRC-32C continuing from crc (0 to start)           */
+extern uint32_t inet_sum(uint32_t sum, const void *data, size_t len);
+extern uint32_t crc32c(uint32_t crc, const void *data, size_t len);
@@ -0,0 +1,252 @@
+/* Micro-benchmark of the checksum engines (see checksum.h): what each one
+   costs per packet and how many corrupted packets it catches.
+
+   usage: cksumbench [-n packets] [-s seed]
+
+   The packets look like the protocol's own: half are data packets with a
+   sequence number and a message of random letters, half pure ACKs with a
+   cumulative ACK and a sparse SACK bitmap.  The cost is the time taken to
+   checksum a set of PACKETS of them, repeated until -n packets (10 million
+   by default) are done; the best of three runs is reported.
+
+   Then every packet is corrupted once in each of the ways below, and a
+   corruption counts as detected if the packet no longer matches its
+   checksum.  Corruptions that leave a packet unchanged (such as swapping
+   two equal bytes) are not counted.  The first three are the emulator's
+   own corruption modes, done by corruptpacket(); the rest are errors of
+   real links, which the legacy sum is weak against. */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include "emulator.h"
+#include "checksum.h"
+#include "rng.h"
+
+#define PACKETS 4096 /* packets in the set */
+#define RUNS 3       /* timed runs of each engine */
+#define COVERED (int)(offsetof(struct pkt, checksum) + 20) /* bytes the corruptions hit */
+
+/* corruption modes */
+enum
+{
+  M_PAYLOAD, /* the emulator's: payload[0] = 'Z' */
+  M_SEQNUM,  /* the emulator's: seqnum = 999999 */
+  M_ACKNUM,  /* the emulator's: acknum = 999999 */
+  M_BITFLIP, /* one bit flipped */
+  M_TWOBITS, /* two bits flipped */
+  M_SWAP,    /* two bytes swapped */
+  M_CANCEL,  /* one byte increased and another decreased by the same amount */
+  M_BURST,   /* a burst of bit errors at most 32 bits long */
+  M_NMODES
+};
+
+static const char *modenames[M_NMODES] = {"payload", "seqnum", "acknum", "bitflip",
+                                          "2bits", "swap", "cancel", "burst"};
+
+static struct rng rng;
+static struct pkt pkts[PACKETS];
+
+static double now(void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/* uniform integer in [0, n) */
+static int randint(int n)
+{
+  int i = (int)(rng_uniform(&rng) * n);
+
+  return i < n ? i : n - 1;
+}
+
+/* byte b of the ones corruptions hit: seqnum and acknum, then the payload */
+static unsigned char *covered(struct pkt *packet, int b)
+{
+  if (b < COVERED - 20)
+    return (unsigned char *)packet + b;
+  return (unsigned char *)&packet->payload[b - (COVERED - 20)];
+}
+
+static void flipbit(struct pkt *packet, int bit)
+{
+  *covered(packet, bit / 8) ^= (unsigned char)(1 << (bit % 8));
+}
+
+static void makepackets(void)
+{
+  int i, j;
+
+  for (i = 0; i < PACKETS; i++)
+  {
+    memset(&pkts[i], 0, sizeof(pkts[i]));
+    pkts[i].length = 20;
+    if (i % 2 == 0)
+    {
+      pkts[i].seqnum = randint(16);
+      pkts[i].acknum = -1;
+      for (j = 0; j < 20; j++)
+        pkts[i].payload[j] = (char)('a' + randint(26));
+    }
+    else
+    {
+      pkts[i].seqnum = -1;
+      pkts[i].acknum = randint(16);
+      for (j = 0; j < 20 * 8; j++)
+        if (randint(8) == 0)
+          pkts[i].payload[j / 8] |= (char)(1 << (j % 8));
+    }
+  }
+}
+
+static void corrupt(struct pkt *packet, int mode)
+{
+  unsigned char *p, *q, t;
+  int i, j, len, start;
+  uint32_t pattern;
+
+  switch (mode)
+  {
+  case M_PAYLOAD:
+    corruptpacket(packet, 0.0);
+    break;
+  case M_SEQNUM:
+    corruptpacket(packet, 0.8);
+    break;
+  case M_ACKNUM:
+    corruptpacket(packet, 0.9);
+    break;
+  case M_BITFLIP:
+    flipbit(packet, randint(COVERED * 8));
+    break;
+  case M_TWOBITS:
+    i = randint(COVERED * 8);
+    j = (i + 1 + randint(COVERED * 8 - 1)) % (COVERED * 8);
+    flipbit(packet, i);
+    flipbit(packet, j);
+    break;
+  case M_SWAP:
+    i = randint(COVERED);
+    j = (i + 1 + randint(COVERED - 1)) % COVERED;
+    p = covered(packet, i);
+    q = covered(packet, j);
+    t = *p;
+    *p = *q;
+    *q = t;
+    break;
+  case M_CANCEL:
+    i = randint(COVERED);
+    j = (i + 1 + randint(COVERED - 1)) % COVERED;
+    t = (unsigned char)(1 + randint(15));
+    *covered(packet, i) += t;
+    *covered(packet, j) -= t;
+    break;
+  case M_BURST:
+    len = 1 + randint(32);
+    start = randint(COVERED * 8 - len + 1);
+    pattern = 1 | (uint32_t)1 << (len - 1);
+    for (i = 1; i < len - 1; i++)
+      pattern |= (uint32_t)randint(2) << i;
+    for (i = 0; i < len; i++)
+      if ((pattern >> i) & 1)
+        flipbit(packet, start + i);
+    break;
+  }
+}
+
+/* nanoseconds engine fn takes per packet */
+static double cost(checksum_fn *fn, long long n)
+{
+  volatile int sink = 0;
+  double t0, best = 0.0;
+  long long done;
+  int run, i, sum;
+
+  for (run = 0; run < RUNS; run++)
+  {
+    t0 = now();
+    sum = 0;
+    for (done = 0; done < n; done += PACKETS)
+      for (i = 0; i < PACKETS; i++)
+        sum += fn(&pkts[i]);
+    sink += sum;
+    t0 = now() - t0;
+    if (run == 0 || t0 < best)
+      best = t0;
+  }
+  (void)sink;
+  return best * 1e9 / ((n + PACKETS - 1) / PACKETS * PACKETS);
+}
+
+/* percentage of the packets corrupted in the given mode that fn detects */
+static double detection(checksum_fn *fn, int mode)
+{
+  struct pkt packet;
+  int i, changed = 0, detected = 0;
+
+  for (i = 0; i < PACKETS; i++)
+  {
+    packet = pkts[i];
+    packet.checksum = fn(&packet);
+    corrupt(&packet, mode);
+    if (packet.seqnum == pkts[i].seqnum && packet.acknum == pkts[i].acknum &&
+        memcmp(packet.payload, pkts[i].payload, sizeof(packet.payload)) == 0)
+      continue;
+    changed++;
+    if (fn(&packet) != packet.checksum)
+      detected++;
+  }
+  return changed > 0 ? 100.0 * detected / changed : 100.0;
+}
+
+static void usage(const char *prog)
+{
+  fprintf(stderr, "usage: %s [-n packets] [-s seed]\n", prog);
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+  long long n = 10000000;
+  unsigned long long seed = 9999;
+  checksum_fn *fn;
+  int engine, mode, opt;
+
+  while ((opt = getopt(argc, argv, "n:s:")) != -1)
+  {
+    switch (opt)
+    {
+    case 'n':
+      n = atoll(optarg);
+      break;
+    case 's':
+      seed = strtoull(optarg, NULL, 0);
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (optind != argc || n < 1)
+    usage(argv[0]);
+
+  rng_seed(&rng, RNG_XOSHIRO, seed, 0);
+  makepackets();
+
+  printf("%-8s %9s", "engine", "ns/pkt");
+  for (mode = 0; mode < M_NMODES; mode++)
+    printf(" %8s", modenames[mode]);
+  printf("   (%% of corrupted packets detected)\n");
+  for (engine = 0; engine < CK_NENGINES; engine++)
+  {
+    fn = checksum_func(engine);
+    printf("%-8s %9.2f", checksum_name(engine), cost(fn, n));
+    for (mode = 0; mode < M_NMODES; mode++)
+      printf(" %8.2f", detection(fn, mode));
+    printf("\n");
+  }
+  return EXIT_SUCCESS;
+}
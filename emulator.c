@@ -33,23 +33,44 @@
    soon as n packets are sent.
    - fixed C style to adhere to current programming style
 
+   Later modifications:
+   - pending events are kept in a pluggable event queue (evqueue.c)
+   instead of a sorted list, and come from a slab pool with the packet
+   stored inline.
+   - running timers and the tail of each channel direction are tracked
+   directly instead of by scanning the pending events.
+   - the clock counts integer ticks (TICKS_PER_UNIT per time unit) rather
+   than float time units, which ran out of precision on long runs.
+   - all emulator state lives in a "struct sim" instead of file-scope
+   globals, so the emulator can be embedded as a library and any number
+   of runs can coexist in one process (see emulator.h).
+   - tracing goes through trace points that store binary records in a
+   ring buffer (trace.c) and compile out with -DNTRACE.
+   - every message taken by the transport is remembered until it is
+   delivered, and its delivery latency goes into a histogram (hist.c).
+   - a transport can build a packet in place in the arrival event that
+   will carry it (tolayer3_begin/tolayer3_commit), and is handed a
+   pointer to it on arrival, so packets are not copied on the way.
+   - a packet says how much of its payload is in use, so a transport can
+   pack several messages into one.
+   - each direction of the channel follows a model of its own (channel.c):
+   the original, bursty loss, a link of finite bandwidth or one that
+   reorders packets.
+   - a run can log its random decisions and another replay them
+   (replay.c), so that a run can be repeated under a changed transport.
+
    ********************************************************************* */
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include "emulator.h"
 #include "sr.h"
-
-struct event
-{
-  float evtime;       /* event time */
-  int evtype;         /* event type code */
-  int eventity;       /* entity where event occurs */
-  struct pkt *pktptr; /* ptr to packet (if any) assoc w/ this event */
-  struct event *prev;
-  struct event *next;
-};
-
-struct event *evlist = NULL; /* the event list */
+#include "evqueue.h"
+#include "rng.h"
+#include "trace.h"
+#include "hist.h"
+#include "channel.h"
+#include "replay.h"
 
 /* possible events: */
 #define TIMER_INTERRUPT 0
@@ -59,444 +80,971 @@ struct event *evlist = NULL; /* the event list */
 #define OFF 0
 #define ON 1
 
-int TRACE = 3;
-
-/* statistics updated by GBN */
-int window_full; /* count of the number of messages dropped due to full window */
-int total_ACKs_received;
-int packets_resent;   /* count of the number of packets resent  */
-int new_ACKs;         /* count of the number of acks correctly received */
-int packets_received; /* count of the packets received by receiver */
-
-/* statistics updated by emulator */
-static int packets_lost;
-static int packets_corrupt;
-static int packets_sent;
-static int packets_timeout;
-static int messages_delivered;
-
-static int nsim = 0;    /* number of messages from 5 to 4 so far */
-static int nsimmax = 0; /* number of msgs to generate, then stop */
-static float time = 0.000;
-static float lossprob;       /* probability that a packet is dropped  */
-static float corruptprob;    /* probability that one bit is packet is flipped */
-static int corruptdirection; /* A->B A<-B or bidirectional corruption/loss */
-static float lambda;         /* arrival rate of messages from layer 5 */
-static int ntolayer3;        /* number sent into layer 3 */
-static int nlost;            /* number lost in media */
-static int ncorrupt;         /* number corrupted by media*/
+#define POOLSLAB 256 /* events per slab of the event pool */
+#define TRACEBUF 4096 /* trace records held before flushing */
+
+struct slab
+{
+  struct slab *next;
+  struct event events[POOLSLAB];
+};
+
+/* state of the channel towards each entity (channels[B] carries A->B) */
+struct channel
+{
+  int inflight;        /* packets scheduled but not yet delivered */
+  int bytesinflight;   /* bytes of those packets */
+  int peakinflight;    /* high-water mark of inflight */
+  int peakbytes;       /* high-water mark of bytesinflight */
+  double occupancy;    /* integral of inflight over time, in ticks */
+  int64_t lastchange;  /* time inflight last changed */
+};
+
+/* a message taken by the transport and not yet delivered */
+struct sentmsg
+{
+  int64_t time;   /* when it came from layer 5 */
+  char tag;       /* its first character, which tells it from its neighbours */
+  char delivered; /* set when delivered out of order ahead of older ones */
+};
+
+/* messages on their way to one entity, oldest first */
+struct msgfifo
+{
+  struct sentmsg *q; /* ring of cap entries, cap a power of two */
+  int cap;
+  int head;
+  int count;
+};
+
+/* packets awaiting an ACK at one entity, as reported by the transport */
+struct window
+{
+  int outstanding;
+  int peak;
+  double occupancy; /* integral of outstanding over time, in ticks */
+  int64_t lastchange;
+};
+
+/* a congestion window, averaged over time */
+struct cwnd
+{
+  double cwnd;
+  double occupancy; /* integral of cwnd over time, in ticks */
+  int64_t lastchange;
+};
+
+struct sim
+{
+  struct sim_config cfg;
+  struct sim_stats stats;
+
+  int64_t time;               /* current time, in ticks */
+  struct evqueue evq;         /* the pending events */
+  struct event *timers[2];    /* pending timer interrupt of A and B, if any */
+  struct channel channels[2];
+  struct chanmodel models[2]; /* model of the packets A and B send */
+  struct window windows[2];   /* send window of A and B */
+  struct window queues[2];    /* send queue of A and B, kept like a window */
+  struct cwnd cwnds[2];       /* congestion window of A and B */
+  struct hist queuedepth[2];  /* depth of the send queues as messages join them */
+  struct hist queuedelay[2];  /* time messages waited in the send queues */
+  struct msgfifo sent[2];     /* messages on their way to A and B */
+  struct hist latency[2];     /* latency of messages delivered to A and B */
+
+  /* event pool */
+  struct slab *slabs;         /* every slab allocated so far */
+  struct event *freeevents;   /* free list, linked through next */
+  int poolinuse;              /* events handed out and not yet freed */
+  struct event *building;     /* event of the packet between tolayer3_begin */
+                              /* and tolayer3_commit */
+
+  struct rng rng;             /* random number generator */
+  struct replaylog log;       /* random decisions recorded or being replayed */
+  int replaying;
+  struct tracebuf trace;      /* trace records not yet written out */
+
+  /* transport protocol state */
+  void *transport;
+  void (*transportfree)(void *);
+};
 
 /****************************************************************************/
 /* jimsrand(): return a double in range [0,1].  The routine below is used to */
-/* isolate all random number generation in one location.  We assume that the*/
-/* system-supplied rand() function return an int in therange [0,mmm]        */
+/* isolate all random number generation in one location.  Each sim has its  */
+/* own generator (see rng.c), chosen and seeded through its sim_config.      */
 /****************************************************************************/
-double jimsrand(void)
+static double jimsrand(struct sim *sim)
 {
-  double mmm = RAND_MAX; /* largest int  - MACHINE DEPENDENT!!!!!!!!   */
-  double x;
-  x = rand() / mmm; /* x should be uniform in [0,1] */
-  if (TRACE > 3)
-    printf("RANDOM NUMBER GENERAION CALLED: %f\n", x);
-  return (x);
+  return rng_uniform(&sim->rng);
 }
 
-/********************* EVENT HANDLINE ROUTINES *******/
-/*  The next set of routines handle the event list   */
+/* a span of simulated time, in ticks */
+static int64_t ticks(double units)
+{
+  return (int64_t)(units * TICKS_PER_UNIT + 0.5);
+}
+
+/* a time in ticks, in time units */
+static double units(int64_t t)
+{
+  return (double)t / TICKS_PER_UNIT;
+}
+
+/********************* EVENT POOL ********************/
+/*  Events (with the packet they carry stored inline)  */
+/*  come from slabs owned by the emulator and go back  */
+/*  onto a free list, so a running simulation does not */
+/*  call malloc/free once the pool has warmed up.      */
 /*****************************************************/
 
-void insertevent(struct event *p)
+static struct event *newevent(struct sim *sim)
 {
-  struct event *q, *qold;
+  struct slab *sp;
+  struct event *evptr;
+  int i;
 
-  if (TRACE > 2)
+  if (sim->freeevents == NULL)
   {
-    printf("            INSERTEVENT: time is %f\n", time);
-    printf("            INSERTEVENT: future time will be %f\n", p->evtime);
+    sp = malloc(sizeof(struct slab));
+    if (sp == 0)
+    {
+      printf("memory allocation for event failed.");
+      exit(EXIT_FAILURE);
+    }
+    sp->next = sim->slabs;
+    sim->slabs = sp;
+    sim->stats.poolevents += POOLSLAB;
+    for (i = POOLSLAB - 1; i >= 0; i--)
+    {
+      sp->events[i].next = sim->freeevents;
+      sim->freeevents = &sp->events[i];
+    }
   }
-  q = evlist; /* q points to front of list in which p struct inserted */
-  if (q == NULL)
-  { /* list is empty */
-    evlist = p;
-    p->next = NULL;
-    p->prev = NULL;
+  evptr = sim->freeevents;
+  sim->freeevents = evptr->next;
+  if (++sim->poolinuse > sim->stats.poolpeak)
+    sim->stats.poolpeak = sim->poolinuse;
+  return evptr;
+}
+
+static void freeevent(struct sim *sim, struct event *evptr)
+{
+  evptr->next = sim->freeevents;
+  sim->freeevents = evptr;
+  sim->poolinuse--;
+}
+
+static void freepool(struct sim *sim)
+{
+  struct slab *sp;
+
+  while ((sp = sim->slabs) != NULL)
+  {
+    sim->slabs = sp->next;
+    free(sp);
   }
-  else
+  sim->freeevents = NULL;
+}
+
+/********************* CHANNEL STATE ****************/
+
+/* a packet of the given size was put on (delta 1), or taken off (delta */
+/* -1), the channel towards entity AorB */
+static void channelupdate(struct sim *sim, int AorB, int delta, int bytes)
+{
+  struct channel *ch = &sim->channels[AorB];
+
+  ch->occupancy += ch->inflight * (double)(sim->time - ch->lastchange);
+  ch->lastchange = sim->time;
+  ch->inflight += delta;
+  ch->bytesinflight += delta * bytes;
+  if (ch->inflight > ch->peakinflight)
+    ch->peakinflight = ch->inflight;
+  if (ch->bytesinflight > ch->peakbytes)
+    ch->peakbytes = ch->bytesinflight;
+}
+
+/********************* MESSAGE LATENCY ************/
+/*  Messages carry no sequence number of their own,  */
+/*  so a delivered message is matched to the oldest  */
+/*  outstanding one with the same (cycling) letter.  */
+/****************************************************/
+
+static void sentmsg(struct sim *sim, int AorB, char tag)
+{
+  struct msgfifo *f = &sim->sent[AorB];
+  struct sentmsg *q;
+  int i;
+
+  if (f->count == f->cap)
   {
-    for (qold = q; q != NULL && p->evtime > q->evtime; q = q->next)
-      qold = q;
+    q = malloc((f->cap ? 2 * f->cap : 64) * sizeof(struct sentmsg));
     if (q == NULL)
-    { /* end of list */
-      qold->next = p;
-      p->prev = qold;
-      p->next = NULL;
-    }
-    else if (q == evlist)
-    { /* front of list */
-      p->next = evlist;
-      p->prev = NULL;
-      p->next->prev = p;
-      evlist = p;
-    }
-    else
-    { /* middle of list */
-      p->next = q;
-      p->prev = q->prev;
-      q->prev->next = p;
-      q->prev = p;
+    {
+      printf("memory allocation for message list failed.");
+      exit(EXIT_FAILURE);
     }
+    for (i = 0; i < f->count; i++)
+      q[i] = f->q[(f->head + i) & (f->cap - 1)];
+    free(f->q);
+    f->q = q;
+    f->cap = f->cap ? 2 * f->cap : 64;
+    f->head = 0;
   }
+  q = &f->q[(f->head + f->count) & (f->cap - 1)];
+  q->time = sim->time;
+  q->tag = tag;
+  q->delivered = 0;
+  f->count++;
 }
 
-void generate_next_arrival(void)
+static void deliveredmsg(struct sim *sim, int AorB, char tag)
+{
+  struct msgfifo *f = &sim->sent[AorB];
+  struct sentmsg *q = NULL;
+  int i;
+
+  for (i = 0; i < f->count; i++)
+  {
+    q = &f->q[(f->head + i) & (f->cap - 1)];
+    if (!q->delivered && q->tag == tag)
+      break;
+  }
+  if (i == f->count)
+  {
+    sim->stats.unmatched++;
+    return;
+  }
+  hist_record(&sim->latency[AorB], units(sim->time - q->time));
+  q->delivered = 1;
+  /* drop delivered messages from the front */
+  while (f->count > 0 && f->q[f->head].delivered)
+  {
+    f->head = (f->head + 1) & (f->cap - 1);
+    f->count--;
+  }
+}
+
+/********************* EVENT HANDLINE ROUTINES *******/
+/*  The next set of routines handle the event list   */
+/*****************************************************/
+
+static void insertevent(struct sim *sim, struct event *p)
+{
+  TRACEPOINT(sim, TR_INSERTEVENT, p->eventity, 0, 0, 0, units(p->evtime), NULL);
+  evq_insert(&sim->evq, p);
+}
+
+static void generate_next_arrival(struct sim *sim)
 {
   double x;
+  int64_t gap;
+  int entity;
   struct event *evptr;
 
-  if (TRACE > 2)
-    printf("          GENERATE NEXT ARRIVAL: creating new arrival\n");
+  TRACEPOINT(sim, TR_ARRIVAL, A, 0, 0, 0, 0.0, NULL);
 
-  x = lambda * jimsrand() * 2; /* x is uniform on [0,2*lambda] */
-  /* having mean of lambda        */
-  evptr = malloc(sizeof(struct event));
-  if (evptr == 0)
+  if (!sim->replaying || !rp_getarrival(&sim->log, &gap, &entity))
   {
-    printf("memory allocation for event failed.");
-    exit(EXIT_FAILURE);
+    if (sim->replaying)
+      sim->stats.unreplayed++;
+    x = sim->cfg.lambda * jimsrand(sim) * 2; /* x is uniform on [0,2*lambda] */
+    /* having mean of lambda        */
+    gap = ticks(x);
+    if (sim->cfg.bidirectional && (jimsrand(sim) > 0.5))
+      entity = B;
+    else
+      entity = A;
   }
-  evptr->evtime = time + x;
+  if (sim->cfg.record)
+    rp_putarrival(&sim->log, gap, entity);
+  evptr = newevent(sim);
+  evptr->evtime = sim->time + gap;
   evptr->evtype = FROM_LAYER5;
-  if (BIDIRECTIONAL && (jimsrand() > 0.5))
-    evptr->eventity = B;
-  else
-    evptr->eventity = A;
-  insertevent(evptr);
+  evptr->eventity = entity;
+  insertevent(sim, evptr);
 }
 
-void printevlist(void)
+void printevlist(struct sim *sim)
 {
   struct event *q;
   printf("--------------\nEvent List Follows:\n");
-  for (q = evlist; q != NULL; q = q->next)
+  for (q = evq_first(&sim->evq); q != NULL; q = evq_next(&sim->evq, q))
   {
-    printf("Event time: %f, type: %d entity: %d\n", q->evtime, q->evtype, q->eventity);
+    printf("Event time: %f, type: %d entity: %d\n", units(q->evtime), q->evtype, q->eventity);
   }
   printf("--------------\n");
 }
 
-void init(void) /* initialize the simulator */
+/********************** SIMULATION CONTROL ***********************/
+
+void sim_defaults(struct sim_config *cfg)
 {
+  memset(cfg, 0, sizeof(*cfg));
+  cfg->nsimmax = 0;
+  cfg->lossprob = 0.0;
+  cfg->corruptprob = 0.0;
+  cfg->corruptdirection = 0;
+  cfg->lambda = 0.0;
+  cfg->trace = 3;
+  cfg->evqengine = EVQ_HEAP;
+  cfg->rng = RNG_XOSHIRO;
+  cfg->seed = 9999;
+  cfg->stream = 0;
+  chan_spec(&cfg->channel[A], CHM_IID);
+  chan_spec(&cfg->channel[B], CHM_IID);
+}
+
+/* true if packets AorB sends may be lost or corrupted at random */
+static int lossy(const struct sim *sim, int AorB)
+{
+  int corruptdirection = sim->cfg.corruptdirection;
+
+  return !(AorB == B && corruptdirection == A) && !(AorB == A && corruptdirection == B);
+}
+
+const char *sim_checkconfig(const struct sim_config *cfg)
+{
+  const char *why;
+
+  if (cfg->evqengine < 0 || cfg->evqengine >= EVQ_NENGINES)
+    return "unknown event queue engine";
+  if (cfg->rng < 0 || cfg->rng >= RNG_NKINDS)
+    return "unknown random number generator";
+  if ((why = chan_checkspec(&cfg->channel[A])) != NULL || (why = chan_checkspec(&cfg->channel[B])) != NULL)
+    return why;
+  return sr_checkconfig(cfg);
+}
+
+struct sim *sim_create(const struct sim_config *cfg) /* initialize the simulator */
+{
+  struct sim *sim;
   float sum, avg;
   int i;
 
-  printf("-----  Stop and Wait Network Simulator Version 1.1 -------- \n\n");
-  printf("Enter the number of messages to simulate: ");
-  scanf("%d", &nsimmax);
-  printf("Enter  packet loss probability [enter 0.0 for no loss]:");
-  scanf("%f", &lossprob);
-  printf("Enter packet corruption probability [0.0 for no corruption]:");
-  scanf("%f", &corruptprob);
-  if (lossprob != 0.0 || corruptprob != 0.0)
+  if (sim_checkconfig(cfg) != NULL)
+    return NULL;
+
+  sim = malloc(sizeof(struct sim));
+  if (sim == 0)
   {
-    printf("If you want loss or corruption to only occur in one direction, choose the direction: 0 A->B, 1 A<-B, 2 A<->B (both directions) :");
-    scanf("%d", &corruptdirection);
+    printf("memory allocation for simulation failed.");
+    return NULL;
   }
-  printf("Enter average time between messages from sender's layer5 [ > 0.0]:");
-  scanf("%f", &lambda);
-  printf("Enter TRACE:");
-  scanf("%d", &TRACE);
+  memset(sim, 0, sizeof(struct sim)); /* initialise statistics */
+  sim->cfg = *cfg;
+  /* give the protocol ample time to finish, but stop one that never goes quiet */
+  if (sim->cfg.maxtime == 0.0)
+    sim->cfg.maxtime = 2.0 * cfg->lambda * cfg->nsimmax;
 
-  srand(9999); /* init random number generator */
+  rng_seed(&sim->rng, cfg->rng, cfg->seed, cfg->stream); /* init random number generator */
   sum = 0.0;   /* test random number generator for students */
   for (i = 0; i < 1000; i++)
-    sum += jimsrand(); /* jimsrand() should be uniform in [0,1] */
+    sum += jimsrand(sim); /* jimsrand() should be uniform in [0,1] */
   avg = sum / 1000.0;
   if (avg < 0.25 || avg > 0.75)
   {
     printf("It is likely that random number generation on your machine\n");
     printf("is different from what this emulator expects.  Please take\n");
     printf("a look at the routine jimsrand() in the emulator code. Sorry. \n");
-    exit(EXIT_FAILURE);
+    free(sim);
+    return NULL;
   }
 
-  /* initialise statistics */
-  window_full = 0;
-  total_ACKs_received = 0;
-  packets_resent = 0;
-  new_ACKs = 0;
-  packets_received = 0;
-  packets_lost = 0;
-  packets_corrupt = 0;
-  packets_sent = 0;
-  packets_timeout = 0;
-  messages_delivered = 0;
-
-  ntolayer3 = 0;
-  nlost = 0;
-  ncorrupt = 0;
+  trace_init(&sim->trace, cfg->trace > 0 ? TRACEBUF : 1);
+  evq_init(&sim->evq, cfg->evqengine);
+  hist_init(&sim->latency[A]);
+  hist_init(&sim->latency[B]);
+  for (i = 0; i < 2; i++)
+  {
+    hist_init(&sim->queuedepth[i]);
+    hist_init(&sim->queuedelay[i]);
+  }
+  for (i = 0; i < 2; i++)
+    chan_init(&sim->models[i], &cfg->channel[i], lossy(sim, i) ? cfg->lossprob : 0.0);
+  rp_init(&sim->log);
+  if (cfg->replay != NULL)
+  {
+    if (rp_read(&sim->log, cfg->replay) != 0)
+    {
+      printf("replay log unreadable.\n");
+      evq_free(&sim->evq);
+      trace_free(&sim->trace);
+      free(sim);
+      return NULL;
+    }
+    sim->replaying = 1;
+  }
+  sim->time = 0;                /* initialize time to 0.0 */
+  generate_next_arrival(sim);   /* initialize event list */
 
-  time = 0.0;              /* initialize time to 0.0 */
-  generate_next_arrival(); /* initialize event list */
+  A_init(sim);
+  B_init(sim);
+  return sim;
 }
 
-/********************** Student-callable ROUTINES ***********************/
+static void latencystats(const struct hist *h, struct sim_latency *l)
+{
+  l->count = (int)h->total;
+  l->mean = h->total > 0 ? h->sum / h->total : 0.0;
+  l->min = h->min;
+  l->p50 = hist_quantile(h, 0.5);
+  l->p90 = hist_quantile(h, 0.9);
+  l->p99 = hist_quantile(h, 0.99);
+  l->p999 = hist_quantile(h, 0.999);
+  l->max = h->max;
+}
 
-/* called by students routine to cancel a previously-started timer */
-void stoptimer(int AorB)
-/* A or B is trying to stop timer */
+void sim_run(struct sim *sim)
 {
-  struct event *q;
+  struct event *eventptr;
+  struct msg msg2give;
+  int i, j, delivered, sent;
 
-  if (TRACE > 1)
-    printf("          STOP TIMER: stopping timer at %f\n", time);
-  /* for (q=evlist; q!=NULL && q->next!=NULL; q = q->next)  */
-  for (q = evlist; q != NULL; q = q->next)
-    if ((q->evtype == TIMER_INTERRUPT && q->eventity == AorB))
+  while (1)
+  {
+    eventptr = evq_pop(&sim->evq); /* get next event to simulate */
+    if (eventptr == NULL)
+      break;
+    if (sim->cfg.maxtime > 0.0 && eventptr->evtime > ticks(sim->cfg.maxtime))
+    { /* out of simulated time: leave the remaining events unsimulated */
+      freeevent(sim, eventptr);
+      break;
+    }
+    sim->time = eventptr->evtime; /* update time to next event time */
+    sim->stats.nevents++;
+    if (eventptr->evtype >= 0 && eventptr->evtype <= FROM_LAYER3)
+      TRACEPOINT(sim, TR_EVENT + eventptr->evtype, eventptr->eventity, 0, 0, 0, 0.0, NULL);
+    if (eventptr->evtype == FROM_LAYER5)
     {
-      /* remove this event */
-      if (q->next == NULL && q->prev == NULL)
-        evlist = NULL;          /* remove first and only event on list */
-      else if (q->next == NULL) /* end of list - there is one in front */
-        q->prev->next = NULL;
-      else if (q == evlist)
-      { /* front of list - there must be event after */
-        q->next->prev = NULL;
-        evlist = q->next;
+      if (sim->stats.nsim < sim->cfg.nsimmax)
+      {
+        generate_next_arrival(sim); /* set up future arrival */
+        /* fill in msg to give with string of same letter */
+        j = sim->stats.nsim % 26;
+        for (i = 0; i < 20; i++)
+          msg2give.data[i] = 97 + j;
+        TRACEPOINT(sim, TR_MAINLOOP, eventptr->eventity, 0, 0, 0, 0.0, msg2give.data);
+        sim->stats.nsim++;
+        if (eventptr->eventity == A ? A_output(sim, msg2give) : B_output(sim, msg2give))
+        {
+          sim->stats.accepted++;
+          sentmsg(sim, 1 - eventptr->eventity, msg2give.data[0]);
+        }
       }
       else
-      { /* middle of list */
-        q->next->prev = q->prev;
-        q->prev->next = q->next;
-      }
-      free(q);
-      return;
+        TRACEPOINT(sim, TR_NOMORE, eventptr->eventity, 0, 0, 0, 0.0, NULL);
     }
-  printf("Warning: unable to cancel your timer. It wasn't running.\n");
-}
-
-void starttimer(int AorB, double increment)
-/* A or B is trying to start timer */
-{
-
-  struct event *q;
-  struct event *evptr;
-
-  if (TRACE > 1)
-    printf("          START TIMER: starting timer at %f\n", time);
-  /* be nice: check to see if timer is already started, if so, then  warn */
-  /* for (q=evlist; q!=NULL && q->next!=NULL; q = q->next)  */
-  for (q = evlist; q != NULL; q = q->next)
-    if ((q->evtype == TIMER_INTERRUPT && q->eventity == AorB))
+    else if (eventptr->evtype == FROM_LAYER3)
     {
-      printf("Warning: attempt to start a timer that is already started\n");
-      return;
+      channelupdate(sim, eventptr->eventity, -1, PKT_SIZE(&eventptr->pkt));
+      if (eventptr->eventity == A)      /* deliver packet by calling */
+        A_input(sim, &eventptr->pkt);   /* appropriate entity, straight */
+      else                              /* from the event */
+        B_input(sim, &eventptr->pkt);
     }
+    else if (eventptr->evtype == TIMER_INTERRUPT)
+    {
+      sim->timers[eventptr->eventity] = NULL; /* timer is no longer running */
+      if (eventptr->eventity == A)
+        A_timerinterrupt(sim);
+      else
+        B_timerinterrupt(sim);
+    }
+    else
+    {
+      sim_traceflush(sim);
+      printf("INTERNAL PANIC: unknown event type \n");
+    }
+    freeevent(sim, eventptr);
+  }
 
-  /* create future event for when timer goes off */
-  evptr = malloc(sizeof(struct event));
-  if (evptr == 0)
+  sim_traceflush(sim);
+
+  /* fill in the statistics that are only known at the end */
+  sim->stats.time = units(sim->time);
+  for (i = 0; i < 2; i++)
   {
-    printf("memory allocation for event failed.");
-    exit(EXIT_FAILURE);
+    channelupdate(sim, i, 0, 0);
+    sim->stats.peakinflight[i] = sim->channels[i].peakinflight;
+    sim->stats.peakbytes[i] = sim->channels[i].peakbytes;
+    sim->stats.avginflight[i] = sim->time > 0 ? sim->channels[i].occupancy / sim->time : 0.0;
+    sim_window(sim, i, sim->windows[i].outstanding);
+    sim->stats.peakwindow[i] = sim->windows[i].peak;
+    sim->stats.avgwindow[i] = sim->time > 0 ? sim->windows[i].occupancy / sim->time : 0.0;
+    latencystats(&sim->latency[i], &sim->stats.latency[i]);
+    sim_queue(sim, i, sim->queues[i].outstanding);
+    sim->stats.peakqueue[i] = sim->queues[i].peak;
+    sim->stats.avgqueue[i] = sim->time > 0 ? sim->queues[i].occupancy / sim->time : 0.0;
+    sim_cwnd(sim, i, sim->cwnds[i].cwnd);
+    sim->stats.avgcwnd[i] = sim->time > 0 ? sim->cwnds[i].occupancy / sim->time : 0.0;
+    latencystats(&sim->queuedepth[i], &sim->stats.queuedepth[i]);
+    latencystats(&sim->queuedelay[i], &sim->stats.queuedelay[i]);
   }
-  evptr->evtime = time + increment;
-  evptr->evtype = TIMER_INTERRUPT;
+  delivered = sim->stats.latency[A].count + sim->stats.latency[B].count;
+  sim->stats.goodput = sim->time > 0 ? delivered / units(sim->time) : 0.0;
+  sent = sim->stats.datapackets[A] + sim->stats.datapackets[B] + sim->stats.packets_resent;
+  sim->stats.retxratio = sent > 0 ? (double)sim->stats.packets_resent / sent : 0.0;
+}
 
-  evptr->eventity = AorB;
-  insertevent(evptr);
+struct sim_stats *sim_stats(struct sim *sim)
+{
+  return &sim->stats;
 }
 
-/************************** TOLAYER3 ***************/
-void tolayer3(int AorB, struct pkt packet)
-/* A or B is sending to network  */
+void sim_report(struct sim *sim)
 {
-  struct pkt *mypktptr;
-  struct event *evptr, *q;
-  float lastime, x;
+  struct sim_stats *st = &sim->stats;
+  const struct chanspec *spec;
   int i;
 
-  ntolayer3++;
+  sim_traceflush(sim);
+  printf(" Simulator terminated at time %f\n after attempting to send %d msgs from layer5\n", st->time, st->nsim);
+  printf("number of messages dropped due to full window:  %d \n", st->window_full);
+  printf("number of valid (not corrupt or duplicate) acknowledgements received at A:  %d \n", st->new_ACKs);
+  printf("(note: a single acknowledgement may have acknowledged more than one packet - if cumulative acknowledgements are used)\n");
+  printf("number of packet resends by A:  %d \n", st->packets_resent);
+  printf("(of which %d spurious, of packets B already had, and %d genuine)\n", st->spurious_resends,
+         st->packets_resent - st->spurious_resends);
+  printf("number of fast retransmits by A:  %d \n", st->fast_retransmits);
+  for (i = 0; i < 2; i++)
+    printf("packets sent by %c: %d, of which %d pure ACKs; %d ACKs piggybacked on data\n",
+           i == A ? 'A' : 'B', st->sent[i], st->acks_sent[i], st->piggybacked[i]);
+  for (i = 0; i < 2; i++)
+    if (sim->cfg.coalesce > 1 && (i == A || sim->cfg.bidirectional))
+      printf("messages coalesced by %c: %d in %d new data packets, %f per packet\n",
+             i == A ? 'A' : 'B', st->datamsgs[i], st->datapackets[i],
+             st->datapackets[i] > 0 ? (double)st->datamsgs[i] / st->datapackets[i] : 0.0);
+  printf("number of correct packets received at B:  %d \n", st->packets_received);
+  printf("number of messages delivered to application:  %d \n", st->messages_delivered);
+  for (i = 0; i < 2; i++)
+    printf("channel %c->%c: at most %d packets (%d bytes) in flight, %f on average\n",
+           i == A ? 'A' : 'B', i == A ? 'B' : 'A', st->peakinflight[1 - i],
+           st->peakbytes[1 - i], st->avginflight[1 - i]);
+  for (i = 0; i < 2; i++)
+  {
+    spec = &sim->models[i].spec;
+    if (spec->model == CHM_GILBERT)
+      printf("channel %c->%c: gilbert model, turns bad with probability %g and good with %g, "
+             "loses %g while bad\n", i == A ? 'A' : 'B', i == A ? 'B' : 'A', spec->pgb, spec->pbg,
+             spec->lossbad);
+    else if (spec->model == CHM_BANDWIDTH)
+      printf("channel %c->%c: bandwidth model, %g bytes per time unit, propagation delay %g\n",
+             i == A ? 'A' : 'B', i == A ? 'B' : 'A', spec->rate, spec->delay);
+    else if (spec->model == CHM_REORDER)
+      printf("channel %c->%c: reorder model, holds back %g of packets\n", i == A ? 'A' : 'B',
+             i == A ? 'B' : 'A', spec->reorder);
+  }
+  if (st->reordered > 0)
+    printf("packets held back to be overtaken: %d\n", st->reordered);
+  if (sim->replaying)
+    printf("replayed from a log: %d arrivals and packets beyond its end drawn afresh\n",
+           st->unreplayed);
+  printf("event pool: %d events in %d slabs, at most %d events pending\n",
+         st->poolevents, st->poolevents / POOLSLAB, st->poolpeak);
+  printf("packets copied on the way: %lld, %f per message delivered\n", st->pktcopies,
+         st->messages_delivered > 0 ? (double)st->pktcopies / st->messages_delivered : 0.0);
+  for (i = 0; i < 2; i++)
+    if (st->latency[i].count > 0)
+      printf("latency to %c: %d messages, mean %f, p50 %f, p99 %f, p99.9 %f, max %f\n",
+             i == A ? 'A' : 'B', st->latency[i].count, st->latency[i].mean, st->latency[i].p50,
+             st->latency[i].p99, st->latency[i].p999, st->latency[i].max);
+  printf("goodput: %f messages per time unit, retransmission ratio: %f\n", st->goodput, st->retxratio);
+  printf("send window of A: %f packets on average, at most %d\n", st->avgwindow[A], st->peakwindow[A]);
+  for (i = 0; i < 2; i++)
+    if (sim->cfg.congestion != 0 && (i == A || sim->cfg.bidirectional))
+      printf("congestion window of %c: %f packets on average, cut %d times\n", i == A ? 'A' : 'B',
+             st->avgcwnd[i], st->cwndcuts[i]);
+  for (i = 0; i < 2; i++)
+    if ((sim->cfg.sendqueue != 0 || sim->cfg.coalesce > 1) && (i == A || sim->cfg.bidirectional))
+      printf("send queue of %c: %f messages on average, at most %d; %d messages waited, "
+             "mean %f, p50 %f, p99 %f, max %f\n",
+             i == A ? 'A' : 'B', st->avgqueue[i], st->peakqueue[i], st->queued[i],
+             st->queuedelay[i].mean, st->queuedelay[i].p50, st->queuedelay[i].p99,
+             st->queuedelay[i].max);
+}
+
+static void writehistjson(FILE *fp, const struct hist *h)
+{
+  uint64_t seen = 0;
+  int i, first = 1;
 
-  /* simulate losses: */
-  if (jimsrand() < lossprob && (!(AorB == B && corruptdirection == A) && !(AorB == A && corruptdirection == B)))
+  fprintf(fp, "[");
+  for (i = 0; i < HIST_SIZE; i++)
   {
-    nlost++;
-    if (TRACE > 0)
-      printf("          TOLAYER3: packet being lost\n");
-    return;
+    if (h->counts[i] == 0)
+      continue;
+    seen += h->counts[i];
+    fprintf(fp, "%s{\"value\": %g, \"count\": %llu, \"percentile\": %g}", first ? "" : ", ",
+            hist_bucketvalue(i), (unsigned long long)h->counts[i], 100.0 * seen / h->total);
+    first = 0;
   }
+  fprintf(fp, "]");
+}
 
-  /* make a copy of the packet student just gave me since he/she may decide */
-  /* to do something with the packet after we return back to him/her */
-  mypktptr = malloc(sizeof(struct pkt));
-  if (mypktptr == 0)
+void sim_writemetrics(struct sim *sim, FILE *fp, int json)
+{
+  struct sim_stats *st = &sim->stats;
+  const struct sim_latency *l;
+  uint64_t seen;
+  int i, j;
+
+  if (!json)
   {
-    printf("memory allocation for event failed.");
-    exit(EXIT_FAILURE);
+    fprintf(fp, "to,value,count,percentile\n");
+    for (i = 0; i < 2; i++)
+      for (j = 0, seen = 0; j < HIST_SIZE; j++)
+        if (sim->latency[i].counts[j] > 0)
+        {
+          seen += sim->latency[i].counts[j];
+          fprintf(fp, "%c,%g,%llu,%g\n", i == A ? 'A' : 'B', hist_bucketvalue(j),
+                  (unsigned long long)sim->latency[i].counts[j], 100.0 * seen / sim->latency[i].total);
+        }
+    return;
   }
-  mypktptr->seqnum = packet.seqnum;
-  mypktptr->acknum = packet.acknum;
-  mypktptr->checksum = packet.checksum;
-  for (i = 0; i < 20; i++)
-    mypktptr->payload[i] = packet.payload[i];
-  if (TRACE > 2)
+  fprintf(fp, "{\"time\": %f, \"messages\": %d, \"accepted\": %d, \"delivered\": %d, \"unmatched\": %d,\n",
+          st->time, st->nsim, st->accepted, st->messages_delivered, st->unmatched);
+  fprintf(fp, " \"goodput\": %f, \"retransmission_ratio\": %f, \"packet_copies\": %lld,\n",
+          st->goodput, st->retxratio, st->pktcopies);
+  fprintf(fp, " \"resends\": %d, \"spurious_resends\": %d, \"genuine_resends\": %d, \"fast_retransmits\": %d,\n",
+          st->packets_resent, st->spurious_resends, st->packets_resent - st->spurious_resends,
+          st->fast_retransmits);
+  fprintf(fp, " \"packets\": {\"A\": {\"sent\": %d, \"acks\": %d, \"piggybacked\": %d, \"data\": %d, \"messages\": %d}, "
+              "\"B\": {\"sent\": %d, \"acks\": %d, \"piggybacked\": %d, \"data\": %d, \"messages\": %d}},\n",
+          st->sent[A], st->acks_sent[A], st->piggybacked[A], st->datapackets[A], st->datamsgs[A],
+          st->sent[B], st->acks_sent[B], st->piggybacked[B], st->datapackets[B], st->datamsgs[B]);
+  fprintf(fp, " \"window\": {\"A\": {\"avg\": %f, \"peak\": %d}, \"B\": {\"avg\": %f, \"peak\": %d}},\n",
+          st->avgwindow[A], st->peakwindow[A], st->avgwindow[B], st->peakwindow[B]);
+  fprintf(fp, " \"cwnd\": {\"A\": {\"avg\": %f, \"cuts\": %d}, \"B\": {\"avg\": %f, \"cuts\": %d}},\n",
+          st->avgcwnd[A], st->cwndcuts[A], st->avgcwnd[B], st->cwndcuts[B]);
+  fprintf(fp, " \"queue\": {");
+  for (i = 0; i < 2; i++)
+    fprintf(fp, "%s\n  \"%c\": {\"queued\": %d, \"avg\": %f, \"peak\": %d,\n   \"depth\": "
+                "{\"p50\": %f, \"p99\": %f, \"max\": %f},\n   \"delay\": {\"mean\": %f, "
+                "\"p50\": %f, \"p90\": %f, \"p99\": %f, \"p999\": %f, \"max\": %f}}",
+            i == A ? "" : ",", i == A ? 'A' : 'B', st->queued[i], st->avgqueue[i], st->peakqueue[i],
+            st->queuedepth[i].p50, st->queuedepth[i].p99, st->queuedepth[i].max,
+            st->queuedelay[i].mean, st->queuedelay[i].p50, st->queuedelay[i].p90,
+            st->queuedelay[i].p99, st->queuedelay[i].p999, st->queuedelay[i].max);
+  fprintf(fp, "},\n");
+  fprintf(fp, " \"latency\": {");
+  for (i = 0; i < 2; i++)
   {
-    printf("          TOLAYER3: seq: %d, ack %d, check: %d ", mypktptr->seqnum,
-           mypktptr->acknum, mypktptr->checksum);
-    for (i = 0; i < 20; i++)
-      printf("%c", mypktptr->payload[i]);
-    printf("\n");
+    l = &st->latency[i];
+    fprintf(fp, "%s\n  \"%c\": {\"count\": %d, \"mean\": %f, \"min\": %f, \"p50\": %f, \"p90\": %f, "
+                "\"p99\": %f, \"p999\": %f, \"max\": %f,\n   \"histogram\": ",
+            i == A ? "" : ",", i == A ? 'A' : 'B', l->count, l->mean, l->min, l->p50, l->p90,
+            l->p99, l->p999, l->max);
+    writehistjson(fp, &sim->latency[i]);
+    fprintf(fp, "}");
   }
+  fprintf(fp, "}}\n");
+}
+
+void sim_destroy(struct sim *sim)
+{
+  if (sim->transportfree != NULL)
+    sim->transportfree(sim->transport);
+  evq_free(&sim->evq);
+  freepool(sim);
+  trace_free(&sim->trace);
+  rp_free(&sim->log);
+  free(sim->sent[A].q);
+  free(sim->sent[B].q);
+  free(sim);
+}
+
+int sim_writelog(struct sim *sim, FILE *fp)
+{
+  return rp_write(&sim->log, fp);
+}
+
+int sim_trace(struct sim *sim)
+{
+  return sim->cfg.trace;
+}
+
+void sim_tracesink(struct sim *sim, FILE *fp, int binary)
+{
+  trace_setsink(&sim->trace, fp, binary);
+  trace_flush(&sim->trace);
+}
+
+void sim_traceflush(struct sim *sim)
+{
+  trace_flush(&sim->trace);
+  if (sim->trace.sink != NULL)
+    fflush(sim->trace.sink);
+}
+
+void sim_tracepoint(struct sim *sim, int type, int entity, int seq, int ack,
+                    int check, double value, const char *data)
+{
+  struct trace_rec rec;
+
+  rec.time = units(sim->time);
+  rec.value = value;
+  rec.seq = seq;
+  rec.ack = ack;
+  rec.check = check;
+  rec.type = (uint16_t)type;
+  rec.entity = (int16_t)entity;
+  if (data != NULL)
+    memcpy(rec.data, data, sizeof(rec.data));
+  else
+    memset(rec.data, 0, sizeof(rec.data));
+  trace_put(&sim->trace, &rec);
+}
+
+double sim_now(struct sim *sim)
+{
+  return units(sim->time);
+}
+
+const struct sim_config *sim_getconfig(struct sim *sim)
+{
+  return &sim->cfg;
+}
+
+void *sim_transport(struct sim *sim)
+{
+  return sim->transport;
+}
 
-  /* create future event for arrival of packet at the other side */
-  evptr = malloc(sizeof(struct event));
-  if (evptr == 0)
+void sim_settransport(struct sim *sim, void *transport, void (*transportfree)(void *))
+{
+  sim->transport = transport;
+  sim->transportfree = transportfree;
+}
+
+/********************** Student-callable ROUTINES ***********************/
+
+/* called by students routine whenever the number of packets it has */
+/* waiting for an ACK changes */
+void sim_window(struct sim *sim, int AorB, int outstanding)
+{
+  struct window *w = &sim->windows[AorB];
+
+  w->occupancy += w->outstanding * (double)(sim->time - w->lastchange);
+  w->lastchange = sim->time;
+  w->outstanding = outstanding;
+  if (outstanding > w->peak)
+    w->peak = outstanding;
+}
+
+/* called by students routine whenever the number of messages waiting */
+/* in its send queue changes */
+void sim_queue(struct sim *sim, int AorB, int depth)
+{
+  struct window *w = &sim->queues[AorB];
+
+  if (depth > w->outstanding)
   {
-    printf("memory allocation for event failed.");
-    exit(EXIT_FAILURE);
+    hist_record(&sim->queuedepth[AorB], depth);
+    sim->stats.queued[AorB]++;
   }
-  evptr->evtype = FROM_LAYER3;      /* packet will pop out from layer3 */
-  evptr->eventity = (AorB + 1) % 2; /* event occurs at other entity */
-  evptr->pktptr = mypktptr;         /* save ptr to my copy of packet */
-  /* finally, compute the arrival time of packet at the other end.
-     medium can not reorder, so make sure packet arrives between 1 and 10
-     time units after the latest arrival time of packets
-     currently in the medium on their way to the destination */
-  lastime = time;
-  /* for (q=evlist; q!=NULL && q->next!=NULL; q = q->next) */
-  for (q = evlist; q != NULL; q = q->next)
-    if ((q->evtype == FROM_LAYER3 && q->eventity == evptr->eventity))
-      lastime = q->evtime;
-  evptr->evtime = lastime + 1 + 9 * jimsrand();
+  w->occupancy += w->outstanding * (double)(sim->time - w->lastchange);
+  w->lastchange = sim->time;
+  w->outstanding = depth;
+  if (depth > w->peak)
+    w->peak = depth;
+}
 
-  /* simulate corruption: */
-  if ((jimsrand() < corruptprob) && (!(AorB == B && corruptdirection == A) && !(AorB == A && corruptdirection == B)))
+/* called by students routine when a message leaves its send queue */
+void sim_dequeued(struct sim *sim, int AorB, double waited)
+{
+  hist_record(&sim->queuedelay[AorB], waited);
+}
+
+/* called by students routine whenever its congestion window changes */
+void sim_cwnd(struct sim *sim, int AorB, double cwnd)
+{
+  struct cwnd *c = &sim->cwnds[AorB];
+
+  c->occupancy += c->cwnd * (double)(sim->time - c->lastchange);
+  c->lastchange = sim->time;
+  c->cwnd = cwnd;
+}
+
+/* called by students routine to cancel a previously-started timer */
+void stoptimer(struct sim *sim, int AorB)
+/* A or B is trying to stop timer */
+{
+  struct event *q;
+
+  TRACEPOINT(sim, TR_STOPTIMER, AorB, 0, 0, 0, 0.0, NULL);
+  q = sim->timers[AorB];
+  if (q == NULL)
   {
-    ncorrupt++;
-    if ((x = jimsrand()) < .75)
-      mypktptr->payload[0] = 'Z'; /* corrupt payload */
-    else if (x < .875)
-      mypktptr->seqnum = 999999;
-    else
-      mypktptr->acknum = 999999;
-    if (TRACE > 0)
-      printf("          TOLAYER3: packet being corrupted\n");
+    sim_traceflush(sim);
+    printf("Warning: unable to cancel your timer. It wasn't running.\n");
+    return;
   }
-
-  if (TRACE > 2)
-    printf("          TOLAYER3: scheduling arrival on other side\n");
-  insertevent(evptr);
+  /* remove this event */
+  evq_remove(&sim->evq, q);
+  freeevent(sim, q);
+  sim->timers[AorB] = NULL;
 }
 
-void tolayer5(int AorB, char datasent[20])
+void starttimer(struct sim *sim, int AorB, double increment)
+/* A or B is trying to start timer */
 {
-  int i;
-  if (TRACE > 2)
+  struct event *evptr;
+
+  TRACEPOINT(sim, TR_STARTTIMER, AorB, 0, 0, 0, increment, NULL);
+  /* be nice: check to see if timer is already started, if so, then  warn */
+  if (sim->timers[AorB] != NULL)
   {
-    printf("          TOLAYER5: data received by application at ");
-    if (AorB == A)
-      printf("A: ");
-    else
-      printf("B: ");
-    for (i = 0; i < 20; i++)
-      printf("%c", datasent[i]);
-    printf("\n");
+    sim_traceflush(sim);
+    printf("Warning: attempt to start a timer that is already started\n");
+    return;
   }
-  messages_delivered++;
+
+  /* create future event for when timer goes off */
+  evptr = newevent(sim);
+  evptr->evtime = sim->time + ticks(increment);
+  evptr->evtype = TIMER_INTERRUPT;
+
+  evptr->eventity = AorB;
+  sim->timers[AorB] = evptr;
+  insertevent(sim, evptr);
 }
 
-int main(void)
+/************************** TOLAYER3 ***************/
+/* the field corruption hits, for x uniform in [0,1): 1 the payload, */
+/* 2 seqnum, 3 acknum */
+static int corruptfield(double x)
 {
-  struct event *eventptr;
-  struct msg msg2give;
-  struct pkt pkt2give;
+  if (x < .75)
+    return 1;
+  else if (x < .875)
+    return 2;
+  return 3;
+}
 
-  int i, j;
+static void corruptfieldof(struct pkt *packet, int field)
+{
+  if (field == 1)
+    packet->payload[0] = 'Z'; /* corrupt payload */
+  else if (field == 2)
+    packet->seqnum = 999999;
+  else
+    packet->acknum = 999999;
+}
 
-  init();
-  A_init();
-  B_init();
+void corruptpacket(struct pkt *packet, double x)
+{
+  corruptfieldof(packet, corruptfield(x));
+}
 
-  while (1)
+/* the fate of the next packet AorB sends: drawn at random, as the */
+/* direction's model has it, or taken from the log being replayed */
+static void packetfate(struct sim *sim, int AorB, struct rppacket *fate)
+{
+  struct chanmodel *m = &sim->models[AorB];
+
+  if (!sim->replaying || !rp_getpacket(&sim->log, AorB, fate))
   {
-    eventptr = evlist; /* get next event to simulate */
-    if (eventptr == NULL)
-      goto terminate;
-    evlist = evlist->next; /* remove this event from event list */
-    if (evlist != NULL)
-      evlist->prev = NULL;
-    if (TRACE >= 2)
-    {
-      printf("\nEVENT time: %f,", eventptr->evtime);
-      printf("  type: %d", eventptr->evtype);
-      if (eventptr->evtype == 0)
-        printf(", timerinterrupt  ");
-      else if (eventptr->evtype == 1)
-        printf(", fromlayer5 ");
-      else
-        printf(", fromlayer3 ");
-      printf(" entity: %d\n", eventptr->eventity);
-    }
-    time = eventptr->evtime; /* update time to next event time */
-    if (eventptr->evtype == FROM_LAYER5)
-    {
-      if (nsim < nsimmax)
-      {
-        generate_next_arrival(); /* set up future arrival */
-        /* fill in msg to give with string of same letter */
-        j = nsim % 26;
-        for (i = 0; i < 20; i++)
-          msg2give.data[i] = 97 + j;
-        if (TRACE > 2)
-        {
-          printf("          MAINLOOP: data given to student: ");
-          for (i = 0; i < 20; i++)
-            printf("%c", msg2give.data[i]);
-          printf("\n");
-        }
-        nsim++;
-        if (eventptr->eventity == A)
-          A_output(msg2give);
-        else
-          B_output(msg2give);
-      }
-      else if (TRACE > 2)
-        printf("          FROM_LAYER5: no more messages to send: \n");
-    }
-    else if (eventptr->evtype == FROM_LAYER3)
+    if (sim->replaying)
+      sim->stats.unreplayed++;
+    memset(fate, 0, sizeof(*fate));
+    fate->lost = chan_lose(m, &sim->rng);
+    fate->bad = m->bad;
+    if (!fate->lost)
     {
-      pkt2give.seqnum = eventptr->pktptr->seqnum;
-      pkt2give.acknum = eventptr->pktptr->acknum;
-      pkt2give.checksum = eventptr->pktptr->checksum;
-      for (i = 0; i < 20; i++)
-        pkt2give.payload[i] = eventptr->pktptr->payload[i];
-      if (eventptr->eventity == A) /* deliver packet by calling */
-        A_input(pkt2give);         /* appropriate entity */
-      else
-        B_input(pkt2give);
-      free(eventptr->pktptr); /* free the memory for packet */
+      chan_delays(m, &sim->rng, &fate->delay);
+      if ((jimsrand(sim) < sim->cfg.corruptprob) && lossy(sim, AorB))
+        fate->corrupt = corruptfield(jimsrand(sim));
     }
-    else if (eventptr->evtype == TIMER_INTERRUPT)
-    {
-      if (eventptr->eventity == A)
-        A_timerinterrupt();
-      else
-        B_timerinterrupt();
-    }
-    else
-    {
-      printf("INTERNAL PANIC: unknown event type \n");
-    }
-    free(eventptr);
   }
+  else
+    m->bad = fate->bad; /* where the recorded run's model went, so that */
+                        /* draws after the log runs out carry on from it */
+  if (sim->cfg.record)
+    rp_putpacket(&sim->log, AorB, fate);
+}
 
-terminate:
-  printf(" Simulator terminated at time %f\n after attempting to send %d msgs from layer5\n", time, nsim);
-  printf("number of messages dropped due to full window:  %d \n", window_full);
-  printf("number of valid (not corrupt or duplicate) acknowledgements received at A:  %d \n", new_ACKs);
-  printf("(note: a single acknowledgement may have acknowledged more than one packet - if cumulative acknowledgements are used)\n");
-  printf("number of packet resends by A:  %d \n", packets_resent);
-  printf("number of correct packets received at B:  %d \n", packets_received);
-  printf("number of messages delivered to application:  %d \n", messages_delivered);
-  return EXIT_SUCCESS;
-}
\ No newline at end of file
+struct pkt *tolayer3_begin(struct sim *sim)
+{
+  if (sim->building == NULL)
+    sim->building = newevent(sim);
+  return &sim->building->pkt;
+}
+
+void tolayer3_commit(struct sim *sim, int AorB)
+/* A or B is sending to network the packet built since tolayer3_begin */
+{
+  struct pkt *mypktptr;
+  struct event *evptr;
+  struct rppacket fate;
+
+  evptr = sim->building;
+  if (evptr == NULL)
+  {
+    sim_traceflush(sim);
+    printf("INTERNAL PANIC: tolayer3_commit without tolayer3_begin \n");
+    exit(EXIT_FAILURE);
+  }
+  sim->building = NULL;
+  mypktptr = &evptr->pkt;
+  sim->stats.ntolayer3++;
+  sim->stats.sent[AorB]++;
+
+  /* simulate losses, as the direction's model has them: */
+  packetfate(sim, AorB, &fate);
+  if (fate.lost)
+  {
+    sim->stats.nlost++;
+    TRACEPOINT(sim, TR_LOST, AorB, mypktptr->seqnum, mypktptr->acknum, mypktptr->checksum, 0.0, NULL);
+    freeevent(sim, evptr);
+    return;
+  }
+
+  /* the packet already lives inside the arrival event itself, where the */
+  /* transport built it */
+  TRACEPOINT(sim, TR_TOLAYER3, AorB, mypktptr->seqnum, mypktptr->acknum, mypktptr->checksum,
+             0.0, mypktptr->payload);
+
+  /* fill in the future event for arrival of packet at the other side */
+  evptr->evtype = FROM_LAYER3;      /* packet will pop out from layer3 */
+  evptr->eventity = (AorB + 1) % 2; /* event occurs at other entity */
+  /* finally, compute the arrival time of packet at the other end.  The
+     original medium can not reorder: it makes the packet arrive between 1
+     and 10 time units after the latest arrival time of packets currently
+     in the medium on their way to the destination */
+  evptr->evtime = chan_arrival(&sim->models[AorB], &fate.delay, sim->time, PKT_SIZE(mypktptr));
+  if (fate.delay.holdback > 0)
+    sim->stats.reordered++;
+  channelupdate(sim, evptr->eventity, 1, PKT_SIZE(mypktptr));
+
+  /* simulate corruption: */
+  if (fate.corrupt)
+  {
+    sim->stats.ncorrupt++;
+    corruptfieldof(mypktptr, fate.corrupt);
+    TRACEPOINT(sim, TR_CORRUPT, AorB, mypktptr->seqnum, mypktptr->acknum, mypktptr->checksum,
+               0.0, NULL);
+  }
+
+  TRACEPOINT(sim, TR_SCHEDULE, AorB, 0, 0, 0, units(evptr->evtime), NULL);
+  insertevent(sim, evptr);
+}
+
+void tolayer3(struct sim *sim, int AorB, struct pkt packet)
+/* A or B is sending to network  */
+{
+  /* make a copy of the packet student just gave me since he/she may decide */
+  /* to do something with the packet after we return back to him/her.  It */
+  /* was copied once already, being passed by value. */
+  *tolayer3_begin(sim) = packet;
+  sim->stats.pktcopies += 2;
+  tolayer3_commit(sim, AorB);
+}
+
+void tolayer5(struct sim *sim, int AorB, const char datasent[20])
+{
+  TRACEPOINT(sim, TR_TOLAYER5, AorB, 0, 0, 0, 0.0, datasent);
+  deliveredmsg(sim, AorB, datasent[0]);
+  sim->stats.messages_delivered++;
+}
@@ -1,15 +1,14 @@
-extern int TRACE;
-
-/* statistics updated by GBN */
-extern int total_ACKs_received;
-extern int packets_resent;       /* count of the number of packets resent  */
-extern int new_ACKs;      /* count of the number of acks correctly received */
-extern int packets_received;  /* count of the packets received by receiver */
-extern int window_full; /* count of the number of messages dropped due to full window */
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
 
 #define   A    0
 #define   B    1
 
+/* the simulated clock counts in integer ticks, so event times stay exact */
+/* however long a run goes on */
+#define TICKS_PER_UNIT 1000000 /* clock ticks per simulated time unit */
+
 /* a "msg" is the data unit passed from layer 5 (teachers code) to layer  */
 /* 4 (students' code).  It contains the data (characters) to be delivered */
 /* to layer 5 via the students transport level protocol entities.         */
@@ -19,22 +18,222 @@ struct msg {
 
 /* a packet is the data unit passed from layer 4 (students code) to layer */
 /* 3 (teachers code).  Note the pre-defined packet structure, which all   */
-/* students must follow. */
+/* students must follow.  Only the first length bytes of the payload are  */
+/* in use: one message's 20, or more when a transport packs several       */
+/* messages into one packet. */
+#define MAXCOALESCE 8 /* messages one packet can carry at most */
+
 struct pkt {
   int seqnum;
   int acknum;
   int checksum;
-  char payload[20];
+  int length;
+  char payload[20 * MAXCOALESCE];
 };
 
+/* bytes of a packet in use, header included */
+#define PKT_SIZE(p) ((int)offsetof(struct pkt, payload) + (p)->length)
+
+/* a "sim" is one independent run of the emulator together with the      */
+/* transport protocol under test.  All of its state hangs off the sim,    */
+/* so a process can create, run and destroy as many of them as it likes.  */
+struct sim;
+
+/* the model of one direction of the channel (see channel.h); */
+/* parameters left CHAN_DEFAULT take the model's defaults, so that 0 */
+/* can be asked for; any other value must be in range */
+#define CHAN_DEFAULT -1.0
+
+struct chanspec {
+  int model;      /* one of CHM_* in channel.h */
+  double pgb;     /* gilbert: chance per packet of a good channel turning bad */
+  double pbg;     /* gilbert: and of a bad one turning good */
+  double lossbad; /* gilbert: loss probability while bad */
+  double rate;    /* bandwidth: bytes serialized per time unit */
+  double delay;   /* bandwidth: propagation delay */
+  double reorder; /* reorder: chance that a packet is held back */
+};
+
+/* parameters of a run, normally read from the user by main() */
+struct sim_config {
+  int nsimmax;               /* number of msgs to generate, then stop */
+  float lossprob;            /* probability that a packet is dropped */
+  float corruptprob;         /* probability that one bit is packet is flipped */
+  int corruptdirection;      /* A->B A<-B or bidirectional corruption/loss */
+  float lambda;              /* arrival rate of messages from layer 5 */
+  int trace;                 /* amount of tracing printed while running */
+  int evqengine;             /* event queue engine, one of EVQ_* in evqueue.h */
+  int rng;                   /* random number generator, one of RNG_* in rng.h */
+  unsigned long long seed;   /* random number generator seed */
+  unsigned long long stream; /* independent stream of that seed, e.g. per sweep point */
+  double maxtime;            /* stop at this simulated time, 0 for twice */
+                             /* the run's expected duration (lambda times */
+                             /* nsimmax), negative for no limit */
+  int windowsize;            /* transport window, in packets (0 for the default) */
+  int seqspace;              /* number of sequence numbers, a power of two */
+                             /* of at least twice the window, more if a */
+                             /* channel reorders (0 for the default) */
+  int bidirectional;         /* B sends messages as well as A */
+  int sendqueue;             /* messages the transport holds while its window */
+                             /* is full (0 for none, negative for no limit) */
+  int dupthresh;             /* ACKs of later packets after which a missing */
+                             /* packet is resent at once (0 for the default, */
+                             /* negative for never) */
+  int checksum;              /* checksum engine, one of CK_* in checksum.h */
+  int coalesce;              /* messages the transport packs into one packet */
+                             /* at most, up to MAXCOALESCE (0 for one each) */
+  int congestion;            /* congestion control, one of CC_* in cc.h */
+  struct chanspec channel[2]; /* model of the packets A and B send (see */
+                             /* chan_spec; iid both ways by default); */
+                             /* corruptdirection still decides which */
+                             /* directions see lossprob and corruptprob */
+  int record;                /* log the run's random decisions, for */
+                             /* sim_writelog (see replay.h) */
+  FILE *replay;              /* take them from this log instead of drawing */
+                             /* them (NULL to draw them) */
+};
+
+/* delivery latency (time from layer 5 at the sender to layer 5 at the */
+/* receiver) of the messages delivered to one entity; also used for the */
+/* depth of and the time spent in a send queue */
+struct sim_latency {
+  int count;  /* messages delivered */
+  double mean;
+  double min;
+  double p50;
+  double p90;
+  double p99;
+  double p999;
+  double max;
+};
+
+/* results of a run */
+struct sim_stats {
+  /* updated by the transport protocol */
+  int window_full; /* count of the number of messages dropped due to full window */
+  int total_ACKs_received;
+  int packets_resent;   /* count of the number of packets resent  */
+  int new_ACKs;         /* count of the number of acks correctly received */
+  int packets_received; /* count of the packets received by receiver */
+  int spurious_resends; /* resent packets the receiver already had */
+  int fast_retransmits; /* resends, of packets_resent, made before the timeout */
+  /* (in a bidirectional run the counts above cover both directions) */
+  int acks_sent[2];     /* pure ACK packets sent by A and B */
+  int piggybacked[2];   /* ACKs A and B sent on data packets instead */
+  int datapackets[2];   /* new data packets sent by A and B (not resends) */
+  int datamsgs[2];      /* messages those carried */
+  int cwndcuts[2];      /* congestion window reductions at A and B */
+
+  /* updated by emulator */
+  double time;            /* simulated time reached */
+  int nsim;               /* number of messages from 5 to 4 */
+  int messages_delivered; /* number of messages passed up to layer 5 */
+  int ntolayer3;          /* number sent into layer 3 */
+  int nlost;              /* number lost in media */
+  int ncorrupt;           /* number corrupted by media*/
+  int reordered;          /* number held back by the media, to be overtaken */
+  int unreplayed;         /* arrivals and packets a replayed run found no */
+                          /* record of, and drew afresh */
+  int peakinflight[2];    /* most packets in flight towards A and B */
+  int peakbytes[2];       /* most bytes (PKT_SIZE) in flight towards A and B */
+  double avginflight[2];  /* time-averaged packets in flight towards A and B */
+  int poolevents;         /* events allocated by the event pool */
+  int poolpeak;           /* most events pending at once */
+  long long nevents;      /* events simulated */
+  long long pktcopies;    /* whole packets copied on their way, by the */
+                          /* emulator and the transport */
+  int accepted;           /* messages taken by the transport */
+  int sent[2];            /* packets sent into layer 3 by A and B */
+  int unmatched;          /* deliveries of no outstanding message (duplicates) */
+  int peakwindow[2];      /* most packets awaiting an ACK at A and B */
+  double avgwindow[2];    /* time-averaged packets awaiting an ACK at A and B */
+  double goodput;         /* distinct messages delivered per time unit */
+  double retxratio;       /* fraction of data packets sent that were resends */
+  struct sim_latency latency[2]; /* latency of messages delivered to A and B */
+  int queued[2];          /* messages that waited in the send queue of A and B */
+  int peakqueue[2];       /* most messages in the send queue of A and B */
+  double avgqueue[2];     /* time-averaged messages in the send queue of A and B */
+  double avgcwnd[2];      /* time-averaged congestion window of A and B */
+  struct sim_latency queuedepth[2]; /* depth of the send queues as messages join */
+  struct sim_latency queuedelay[2]; /* time messages waited in the send queues */
+};
+
+/* fill in the default configuration */
+extern void sim_defaults(struct sim_config *);
+
+/* NULL if the configuration is one a run can be made with, else what */
+/* is wrong with it */
+extern const char *sim_checkconfig(const struct sim_config *);
+
+/* set up a run (calls A_init and B_init), NULL on failure, such as a */
+/* configuration sim_checkconfig rejects */
+extern struct sim *sim_create(const struct sim_config *);
+
+/* simulate until no events are left */
+extern void sim_run(struct sim *);
+
+/* statistics of the run so far */
+extern struct sim_stats *sim_stats(struct sim *);
+
+/* print the end-of-run report */
+extern void sim_report(struct sim *);
+
+/* write the run's metrics, including the full latency histograms, as */
+/* JSON, or the histograms alone as CSV */
+extern void sim_writemetrics(struct sim *, FILE *, int json);
+
+/* write the log of a run made with record set, 0 on success */
+extern int sim_writelog(struct sim *, FILE *);
+
+/* release a run and everything it owns */
+extern void sim_destroy(struct sim *);
+
+/* tracing level of the run */
+extern int sim_trace(struct sim *);
+
+/* current simulated time */
+extern double sim_now(struct sim *);
+
+/* configuration of the run */
+extern const struct sim_config *sim_getconfig(struct sim *);
+
+/* per-run state of the transport protocol, released by sim_destroy */
+/* with the given function */
+extern void *sim_transport(struct sim *);
+extern void sim_settransport(struct sim *, void *, void (*)(void *));
+
+/* A or B (int) now has the given number of packets awaiting an ACK */
+extern void sim_window(struct sim *, int, int);
+
+/* A or B (int) now has the given number of messages in its send queue */
+extern void sim_queue(struct sim *, int, int);
+
+/* a message left the send queue of A or B (int) after the given time */
+extern void sim_dequeued(struct sim *, int, double);
+
+/* A or B (int) now has the given congestion window, in packets */
+extern void sim_cwnd(struct sim *, int, double);
+
 /* send to A or B (int), packet to send */
-extern void tolayer3(int, struct pkt);  
+extern void tolayer3(struct sim *, int, struct pkt);
+
+/* the same without copying the packet: tolayer3_begin returns storage */
+/* for the next packet, in the event that will carry it, which the      */
+/* caller fills in and then sends to A or B (int) with tolayer3_commit. */
+/* On arrival A_input/B_input are given a pointer to that same storage, */
+/* valid until they return. */
+extern struct pkt *tolayer3_begin(struct sim *);
+extern void tolayer3_commit(struct sim *, int);
+
+/* corrupt a packet the way the medium does; x, uniform in [0,1), picks */
+/* which field is hit */
+extern void corruptpacket(struct pkt *, double x);
 
 /* deliver to A or B (int), data to deliver */
-extern void tolayer5(int, char[20]); 
+extern void tolayer5(struct sim *, int, const char[20]);
 
 /* start timer at A or B (int), increment */
-extern void starttimer(int, double);       
+extern void starttimer(struct sim *, int, double);
 
 /* stop timer at A or B (int) */
-extern void stoptimer(int);               
+extern void stoptimer(struct sim *, int);
@@ -0,0 +1,467 @@
+/* Event queue engines for the network emulator.
+
+   The emulator used to keep its pending events in one sorted doubly-linked
+   list, which makes every insertion a linear scan.  The engines below all
+   implement the same ordering as that list (increasing evtime, and among
+   events with equal evtime the one inserted last comes out first) so that a
+   run is identical whichever engine is selected:
+
+   - list:     the original sorted list, kept as a reference.
+   - heap:     a binary heap of event pointers, O(log n) insert/pop/remove.
+   - calendar: a calendar queue (R. Brown, CACM 1988), amortized O(1)
+               insert/pop when event times are reasonably spread out.
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "emulator.h"
+#include "evqueue.h"
+
+/* true if event a must be simulated before event b */
+static int evbefore(const struct event *a, const struct event *b)
+{
+  if (a->evtime != b->evtime)
+    return a->evtime < b->evtime;
+  return a->evseq > b->evseq;
+}
+
+static void *evq_alloc(size_t size)
+{
+  void *p = malloc(size);
+  if (p == NULL)
+  {
+    printf("memory allocation for event queue failed.");
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+/* insert p into the sorted list starting at *head */
+static void sorted_insert(struct event **head, struct event *p)
+{
+  struct event *q, *qold;
+
+  q = *head;
+  if (q == NULL)
+  { /* list is empty */
+    *head = p;
+    p->next = NULL;
+    p->prev = NULL;
+    return;
+  }
+  for (qold = q; q != NULL && evbefore(q, p); q = q->next)
+    qold = q;
+  if (q == NULL)
+  { /* end of list */
+    qold->next = p;
+    p->prev = qold;
+    p->next = NULL;
+  }
+  else if (q == *head)
+  { /* front of list */
+    p->next = *head;
+    p->prev = NULL;
+    p->next->prev = p;
+    *head = p;
+  }
+  else
+  { /* middle of list */
+    p->next = q;
+    p->prev = q->prev;
+    q->prev->next = p;
+    q->prev = p;
+  }
+}
+
+/* remove p from the list starting at *head */
+static void list_unlink(struct event **head, struct event *p)
+{
+  if (p->prev != NULL)
+    p->prev->next = p->next;
+  else
+    *head = p->next;
+  if (p->next != NULL)
+    p->next->prev = p->prev;
+  p->prev = NULL;
+  p->next = NULL;
+}
+
+/********************* LIST ENGINE ******************/
+
+static void list_insert(struct evqueue *q, struct event *p)
+{
+  sorted_insert(&q->head, p);
+  q->size++;
+}
+
+static struct event *list_pop(struct evqueue *q)
+{
+  struct event *p = q->head;
+  if (p != NULL)
+  {
+    list_unlink(&q->head, p);
+    q->size--;
+  }
+  return p;
+}
+
+static void list_remove(struct evqueue *q, struct event *p)
+{
+  list_unlink(&q->head, p);
+  q->size--;
+}
+
+static struct event *list_first(struct evqueue *q)
+{
+  return q->head;
+}
+
+static struct event *list_next(struct evqueue *q, struct event *p)
+{
+  (void)q;
+  return p->next;
+}
+
+/********************* HEAP ENGINE ******************/
+
+static void heap_set(struct evqueue *q, int i, struct event *p)
+{
+  q->heap[i] = p;
+  p->qindex = i;
+}
+
+static void heap_siftup(struct evqueue *q, int i)
+{
+  struct event *p = q->heap[i];
+  int parent;
+
+  while (i > 0)
+  {
+    parent = (i - 1) / 2;
+    if (!evbefore(p, q->heap[parent]))
+      break;
+    heap_set(q, i, q->heap[parent]);
+    i = parent;
+  }
+  heap_set(q, i, p);
+}
+
+static void heap_siftdown(struct evqueue *q, int i)
+{
+  struct event *p = q->heap[i];
+  int child;
+
+  for (;;)
+  {
+    child = 2 * i + 1;
+    if (child >= q->size)
+      break;
+    if (child + 1 < q->size && evbefore(q->heap[child + 1], q->heap[child]))
+      child++;
+    if (!evbefore(q->heap[child], p))
+      break;
+    heap_set(q, i, q->heap[child]);
+    i = child;
+  }
+  heap_set(q, i, p);
+}
+
+static void heap_insert(struct evqueue *q, struct event *p)
+{
+  struct event **grown;
+
+  if (q->size == q->heapcap)
+  {
+    q->heapcap = q->heapcap ? 2 * q->heapcap : 64;
+    grown = evq_alloc(q->heapcap * sizeof(struct event *));
+    if (q->heap != NULL)
+    {
+      memcpy(grown, q->heap, q->size * sizeof(struct event *));
+      free(q->heap);
+    }
+    q->heap = grown;
+  }
+  heap_set(q, q->size, p);
+  q->size++;
+  heap_siftup(q, q->size - 1);
+}
+
+static void heap_remove(struct evqueue *q, struct event *p)
+{
+  int i = p->qindex;
+
+  q->size--;
+  if (i == q->size)
+    return;
+  heap_set(q, i, q->heap[q->size]);
+  if (i > 0 && evbefore(q->heap[i], q->heap[(i - 1) / 2]))
+    heap_siftup(q, i);
+  else
+    heap_siftdown(q, i);
+}
+
+static struct event *heap_pop(struct evqueue *q)
+{
+  struct event *p;
+
+  if (q->size == 0)
+    return NULL;
+  p = q->heap[0];
+  heap_remove(q, p);
+  return p;
+}
+
+static struct event *heap_first(struct evqueue *q)
+{
+  return q->size > 0 ? q->heap[0] : NULL;
+}
+
+static struct event *heap_next(struct evqueue *q, struct event *p)
+{
+  return p->qindex + 1 < q->size ? q->heap[p->qindex + 1] : NULL;
+}
+
+/********************* CALENDAR ENGINE ******************/
+
+#define CAL_MINBUCKETS 2
+#define CAL_SAMPLE 25 /* events sampled to estimate the bucket width */
+
+/* "virtual bucket": the bucket number if the calendar never wrapped */
+static double cal_vbucket(struct evqueue *q, double t)
+{
+  return floor(t / q->width);
+}
+
+static int cal_bucket(struct evqueue *q, double t)
+{
+  return (int)fmod(cal_vbucket(q, t), (double)q->nbuckets);
+}
+
+/* make the calendar's "current day" the one holding time t */
+static void cal_setday(struct evqueue *q, double t)
+{
+  q->lastprio = t;
+  q->lastbucket = cal_bucket(q, t);
+  q->curday = cal_vbucket(q, t);
+}
+
+static void cal_alloc(struct evqueue *q, int nbuckets, double width)
+{
+  q->nbuckets = nbuckets;
+  q->width = width;
+  q->buckets = evq_alloc(nbuckets * sizeof(struct event *));
+  memset(q->buckets, 0, nbuckets * sizeof(struct event *));
+}
+
+static void cal_resize(struct evqueue *, int);
+
+static void cal_place(struct evqueue *q, struct event *p)
+{
+  sorted_insert(&q->buckets[cal_bucket(q, p->evtime)], p);
+}
+
+static void cal_insert(struct evqueue *q, struct event *p)
+{
+  cal_place(q, p);
+  q->size++;
+  if (p->evtime < q->lastprio)
+    cal_setday(q, p->evtime);
+  if (q->size > 2 * q->nbuckets)
+    cal_resize(q, 2 * q->nbuckets);
+}
+
+static void cal_unlink(struct evqueue *q, struct event *p)
+{
+  list_unlink(&q->buckets[cal_bucket(q, p->evtime)], p);
+  q->size--;
+}
+
+/* find and unlink the earliest event, without resizing the calendar */
+static struct event *cal_take(struct evqueue *q)
+{
+  struct event *p, *best;
+  int i, n;
+
+  if (q->size == 0)
+    return NULL;
+
+  /* scan one year of days, starting at the current one */
+  i = q->lastbucket;
+  for (n = 0; n < q->nbuckets; n++)
+  {
+    p = q->buckets[i];
+    if (p != NULL && cal_vbucket(q, p->evtime) <= q->curday)
+    {
+      q->lastbucket = i;
+      q->lastprio = p->evtime;
+      cal_unlink(q, p);
+      return p;
+    }
+    i = (i + 1) & (q->nbuckets - 1);
+    q->curday += 1.0;
+  }
+
+  /* nothing within a year: fall back to a direct search of bucket heads */
+  best = NULL;
+  for (i = 0; i < q->nbuckets; i++)
+    if (q->buckets[i] != NULL && (best == NULL || evbefore(q->buckets[i], best)))
+      best = q->buckets[i];
+  cal_setday(q, best->evtime);
+  cal_unlink(q, best);
+  return best;
+}
+
+/* rebuild the calendar with nbuckets days, re-estimating the day width */
+static void cal_resize(struct evqueue *q, int nbuckets)
+{
+  struct event *sample[CAL_SAMPLE];
+  struct event **old, *p, *all;
+  int nsample, i, nsep;
+  double lastprio, avg, sep, sum, width;
+
+  /* estimate the width from the separation of the next few events */
+  lastprio = q->lastprio;
+  for (nsample = 0; nsample < CAL_SAMPLE && q->size > 0; nsample++)
+    sample[nsample] = cal_take(q);
+  width = q->width;
+  if (nsample > 1)
+  {
+    avg = (sample[nsample - 1]->evtime - sample[0]->evtime) / (nsample - 1);
+    sum = 0.0;
+    nsep = 0;
+    for (i = 1; i < nsample; i++)
+    {
+      sep = sample[i]->evtime - sample[i - 1]->evtime;
+      if (sep <= 2.0 * avg)
+      {
+        sum += sep;
+        nsep++;
+      }
+    }
+    if (nsep > 0 && sum > 0.0)
+      width = 3.0 * sum / nsep;
+  }
+
+  /* gather every remaining event into one chain */
+  all = NULL;
+  for (i = 0; i < q->nbuckets; i++)
+    while ((p = q->buckets[i]) != NULL)
+    {
+      list_unlink(&q->buckets[i], p);
+      p->next = all;
+      all = p;
+    }
+
+  old = q->buckets;
+  cal_alloc(q, nbuckets, width);
+  free(old);
+
+  while ((p = all) != NULL)
+  {
+    all = p->next;
+    cal_place(q, p);
+  }
+  for (i = 0; i < nsample; i++)
+    cal_place(q, sample[i]);
+  q->size += nsample;
+  cal_setday(q, lastprio);
+}
+
+static struct event *cal_pop(struct evqueue *q)
+{
+  struct event *p = cal_take(q);
+
+  if (p != NULL && q->nbuckets > CAL_MINBUCKETS && q->size < q->nbuckets / 2)
+    cal_resize(q, q->nbuckets / 2);
+  return p;
+}
+
+static void cal_remove(struct evqueue *q, struct event *p)
+{
+  cal_unlink(q, p);
+  if (q->nbuckets > CAL_MINBUCKETS && q->size < q->nbuckets / 2)
+    cal_resize(q, q->nbuckets / 2);
+}
+
+static struct event *cal_scanfrom(struct evqueue *q, int i)
+{
+  for (; i < q->nbuckets; i++)
+    if (q->buckets[i] != NULL)
+      return q->buckets[i];
+  return NULL;
+}
+
+static struct event *cal_first(struct evqueue *q)
+{
+  return cal_scanfrom(q, 0);
+}
+
+static struct event *cal_next(struct evqueue *q, struct event *p)
+{
+  if (p->next != NULL)
+    return p->next;
+  return cal_scanfrom(q, cal_bucket(q, p->evtime) + 1);
+}
+
+/********************* ENGINE TABLE ******************/
+
+static const struct evq_ops evq_engines[EVQ_NENGINES] = {
+    {"list", list_insert, list_pop, list_remove, list_first, list_next},
+    {"heap", heap_insert, heap_pop, heap_remove, heap_first, heap_next},
+    {"calendar", cal_insert, cal_pop, cal_remove, cal_first, cal_next},
+};
+
+int evq_engine(const char *name)
+{
+  int i;
+  for (i = 0; i < EVQ_NENGINES; i++)
+    if (strcmp(name, evq_engines[i].name) == 0)
+      return i;
+  return -1;
+}
+
+void evq_init(struct evqueue *q, int engine)
+{
+  memset(q, 0, sizeof(*q));
+  q->ops = &evq_engines[engine];
+  if (engine == EVQ_CALENDAR)
+  {
+    cal_alloc(q, CAL_MINBUCKETS, (double)TICKS_PER_UNIT);
+    cal_setday(q, 0.0);
+  }
+}
+
+void evq_free(struct evqueue *q)
+{
+  free(q->heap);
+  free(q->buckets);
+  q->heap = NULL;
+  q->buckets = NULL;
+}
+
+void evq_insert(struct evqueue *q, struct event *p)
+{
+  p->evseq = q->nextseq++;
+  q->ops->insert(q, p);
+}
+
+struct event *evq_pop(struct evqueue *q)
+{
+  return q->ops->pop(q);
+}
+
+void evq_remove(struct evqueue *q, struct event *p)
+{
+  q->ops->remove(q, p);
+}
+
+struct event *evq_first(struct evqueue *q)
+{
+  return q->ops->first(q);
+}
+
+struct event *evq_next(struct evqueue *q, struct event *p)
+{
+  return q->ops->next(q, p);
+}
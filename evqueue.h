@@ -0,0 +1,77 @@
+/* event queue engines used by the emulator to hold pending events.    */
+/* All engines pop events in increasing evtime; events with the same   */
+/* evtime come out in the order the original sorted event list gave    */
+/* them, i.e. the most recently inserted one first.                    */
+
+#include <stdint.h>
+
+struct event
+{
+  int64_t evtime;        /* event time, in clock ticks */
+  int evtype;            /* event type code */
+  int eventity;          /* entity where event occurs */
+  struct pkt pkt;        /* packet (if any) assoc w/ this event */
+  uint64_t evseq;        /* insertion number, used to break evtime ties */
+  int qindex;            /* slot in the heap array (heap engine only) */
+  struct event *prev;
+  struct event *next;
+};
+
+#define EVQ_LIST 0     /* sorted doubly-linked list, O(n) insert */
+#define EVQ_HEAP 1     /* binary heap, O(log n) insert and pop */
+#define EVQ_CALENDAR 2 /* calendar queue, amortized O(1) insert and pop */
+#define EVQ_NENGINES 3
+
+struct evqueue
+{
+  const struct evq_ops *ops;
+  int size;               /* number of pending events */
+  uint64_t nextseq;       /* insertion counter, never wraps */
+
+  /* list engine */
+  struct event *head;
+
+  /* heap engine */
+  struct event **heap;
+  int heapcap;
+
+  /* calendar engine */
+  struct event **buckets; /* each bucket is a sorted doubly-linked list */
+  int nbuckets;           /* always a power of two */
+  double width;           /* time span covered by one bucket */
+  int lastbucket;         /* bucket of the last event popped */
+  double curday;          /* virtual bucket number of lastbucket */
+  double lastprio;        /* time of the last event popped */
+};
+
+struct evq_ops
+{
+  const char *name;
+  void (*insert)(struct evqueue *, struct event *);
+  struct event *(*pop)(struct evqueue *);
+  void (*remove)(struct evqueue *, struct event *);
+  struct event *(*first)(struct evqueue *);
+  struct event *(*next)(struct evqueue *, struct event *);
+};
+
+/* set up an empty queue using the given engine (EVQ_*) */
+extern void evq_init(struct evqueue *, int engine);
+
+/* release the queue's own storage (not the events still in it) */
+extern void evq_free(struct evqueue *);
+
+/* map an engine name ("list", "heap", "calendar") to EVQ_*, -1 if unknown */
+extern int evq_engine(const char *name);
+
+/* schedule an event */
+extern void evq_insert(struct evqueue *, struct event *);
+
+/* unlink and return the next event to simulate, NULL if queue is empty */
+extern struct event *evq_pop(struct evqueue *);
+
+/* unlink an event that is still in the queue */
+extern void evq_remove(struct evqueue *, struct event *);
+
+/* walk all pending events (in no particular order) */
+extern struct event *evq_first(struct evqueue *);
+extern struct event *evq_next(struct evqueue *, struct event *);
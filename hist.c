@@ -0,0 +1,73 @@
+/* Log-linear histogram.  A value of v units goes to bucket v if v is below
+   2^HIST_SUBBITS; above that, values sharing their top HIST_SUBBITS bits
+   share a bucket, HIST_HALF buckets per power of two. */
+#include <string.h>
+#include <math.h>
+#include "hist.h"
+
+static int bucketof(uint64_t v)
+{
+  int shift = 0;
+
+  if (v < 2 * HIST_HALF)
+    return (int)v;
+  /* shift v down until it lies in [HIST_HALF, 2 * HIST_HALF) */
+  while ((v >> shift) >= 2 * HIST_HALF)
+    shift++;
+  return (shift + 1) * HIST_HALF + (int)((v >> shift) - HIST_HALF);
+}
+
+double hist_bucketvalue(int i)
+{
+  int shift;
+  uint64_t sub;
+
+  if (i < 2 * HIST_HALF)
+    return i * HIST_UNIT;
+  shift = i / HIST_HALF - 1;
+  sub = i % HIST_HALF + HIST_HALF;
+  return (double)(((sub + 1) << shift) - 1) * HIST_UNIT;
+}
+
+void hist_init(struct hist *h)
+{
+  memset(h, 0, sizeof(*h));
+}
+
+void hist_record(struct hist *h, double value)
+{
+  uint64_t v;
+
+  if (value < 0.0)
+    value = 0.0;
+  v = (uint64_t)(value / HIST_UNIT + 0.5);
+  if (v >= (uint64_t)1 << HIST_MAXBITS)
+    v = ((uint64_t)1 << HIST_MAXBITS) - 1;
+  h->counts[bucketof(v)]++;
+  if (h->total == 0 || value < h->min)
+    h->min = value;
+  if (h->total == 0 || value > h->max)
+    h->max = value;
+  h->total++;
+  h->sum += value;
+}
+
+double hist_quantile(const struct hist *h, double q)
+{
+  uint64_t want, seen = 0;
+  int i;
+
+  if (h->total == 0)
+    return 0.0;
+  want = (uint64_t)ceil(q * h->total);
+  if (want < 1)
+    want = 1;
+  for (i = 0; i < HIST_SIZE; i++)
+  {
+    seen += h->counts[i];
+    if (seen >= want)
+      break;
+  }
+  /* a bucket's top value may lie beyond what was actually seen */
+  return hist_bucketvalue(i) < h->max ? hist_bucketvalue(i) : h->max;
+}
@@ -0,0 +1,29 @@
+/* log-linear ("HDR") histogram of non-negative values, used for message */
+/* latencies.  Values are counted in units of HIST_UNIT; every bucket is  */
+/* at most 1/HIST_HALF of its value wide, so any quantile read back is    */
+/* within about 1.6% of the true one.                                     */
+#include <stdint.h>
+
+#define HIST_UNIT 0.001  /* resolution of recorded values */
+#define HIST_SUBBITS 7   /* 2^HIST_SUBBITS buckets below 2^HIST_SUBBITS units */
+#define HIST_HALF (1 << (HIST_SUBBITS - 1))
+#define HIST_MAXBITS 48  /* values up to 2^48 units are kept exactly */
+#define HIST_SIZE ((HIST_MAXBITS - HIST_SUBBITS + 2) * HIST_HALF)
+
+struct hist
+{
+  uint64_t counts[HIST_SIZE];
+  uint64_t total;
+  double sum;            /* of the recorded values, for the mean */
+  double min, max;       /* exact extremes */
+};
+
+extern void hist_init(struct hist *);
+extern void hist_record(struct hist *, double value);
+
+/* smallest recorded value (to bucket precision) that at least a fraction */
+/* q of the values do not exceed, 0 if the histogram is empty */
+extern double hist_quantile(const struct hist *, double q);
+
+/* highest value that falls into bucket i */
+extern double hist_bucketvalue(int i);
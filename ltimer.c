@@ -0,0 +1,149 @@
+/* Logical timers multiplexed onto the emulator's one timer per entity.
+
+   Starting, stopping and expiring a timer are O(log n) heap operations.
+   The emulator timer is only touched by lt_rearm(), and only if the
+   earliest deadline has changed, so a protocol can start and stop many
+   timers while handling one event at the cost of at most one emulator
+   timer restart. */
+#include <stdlib.h>
+#include <stdio.h>
+#include "emulator.h"
+#include "ltimer.h"
+
+void lt_init(struct ltimers *lt, int nids)
+{
+  int i;
+
+  lt->nids = nids;
+  lt->n = 0;
+  lt->heap = malloc(nids * sizeof(int));
+  lt->pos = malloc(nids * sizeof(int));
+  lt->deadline = malloc(nids * sizeof(double));
+  if (lt->heap == NULL || lt->pos == NULL || lt->deadline == NULL)
+  {
+    printf("memory allocation for timers failed.");
+    exit(EXIT_FAILURE);
+  }
+  for (i = 0; i < nids; i++)
+    lt->pos[i] = -1;
+  lt->armed = 0;
+}
+
+void lt_free(struct ltimers *lt)
+{
+  free(lt->heap);
+  free(lt->pos);
+  free(lt->deadline);
+}
+
+/* true if timer a goes off before timer b (ties go to the lower id) */
+static int before(const struct ltimers *lt, int a, int b)
+{
+  if (lt->deadline[a] != lt->deadline[b])
+    return lt->deadline[a] < lt->deadline[b];
+  return a < b;
+}
+
+static void place(struct ltimers *lt, int i, int id)
+{
+  lt->heap[i] = id;
+  lt->pos[id] = i;
+}
+
+static void siftup(struct ltimers *lt, int i)
+{
+  int id = lt->heap[i];
+
+  while (i > 0 && before(lt, id, lt->heap[(i - 1) / 2]))
+  {
+    place(lt, i, lt->heap[(i - 1) / 2]);
+    i = (i - 1) / 2;
+  }
+  place(lt, i, id);
+}
+
+static void siftdown(struct ltimers *lt, int i)
+{
+  int id = lt->heap[i];
+  int child;
+
+  while ((child = 2 * i + 1) < lt->n)
+  {
+    if (child + 1 < lt->n && before(lt, lt->heap[child + 1], lt->heap[child]))
+      child++;
+    if (!before(lt, lt->heap[child], id))
+      break;
+    place(lt, i, lt->heap[child]);
+    i = child;
+  }
+  place(lt, i, id);
+}
+
+void lt_stop(struct ltimers *lt, int id)
+{
+  int i = lt->pos[id];
+  int last;
+
+  if (i < 0)
+    return;
+  lt->pos[id] = -1;
+  if (--lt->n == i)
+    return;
+  /* move the last timer into the hole and restore the heap around it */
+  last = lt->heap[lt->n];
+  place(lt, i, last);
+  siftdown(lt, i);
+  siftup(lt, lt->pos[last]);
+}
+
+void lt_start(struct sim *sim, struct ltimers *lt, int id, double delay)
+{
+  lt_stop(lt, id);
+  lt->deadline[id] = sim_now(sim) + delay;
+  place(lt, lt->n++, id);
+  siftup(lt, lt->n - 1);
+}
+
+int lt_running(const struct ltimers *lt, int id)
+{
+  return lt->pos[id] >= 0;
+}
+
+void lt_interrupt(struct ltimers *lt)
+{
+  lt->armed = 0;
+}
+
+int lt_expired(struct sim *sim, struct ltimers *lt)
+{
+  int id;
+
+  /* the emulator rounds timer increments to clock ticks */
+  if (lt->n == 0 || lt->deadline[lt->heap[0]] > sim_now(sim) + 1.0 / TICKS_PER_UNIT)
+    return -1;
+  id = lt->heap[0];
+  lt_stop(lt, id);
+  return id;
+}
+
+void lt_rearm(struct sim *sim, int AorB, struct ltimers *lt)
+{
+  double first, now;
+
+  if (lt->n == 0)
+  {
+    if (lt->armed)
+      stoptimer(sim, AorB);
+    lt->armed = 0;
+    return;
+  }
+  first = lt->deadline[lt->heap[0]];
+  if (lt->armed && lt->armedfor == first)
+    return;
+  if (lt->armed)
+    stoptimer(sim, AorB);
+  now = sim_now(sim);
+  starttimer(sim, AorB, first > now ? first - now : 0.0);
+  lt->armed = 1;
+  lt->armedfor = first;
+}
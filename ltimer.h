@@ -0,0 +1,36 @@
+/* logical timers for a transport protocol entity.  The emulator gives    */
+/* each entity a single timer; the logical timers (any number of them,    */
+/* named by small integer ids) are kept in a min-heap on their deadlines */
+/* and that one emulator timer is always set for the earliest of them.   */
+
+struct ltimers
+{
+  int nids;         /* ids are 0 .. nids - 1 */
+  int n;            /* timers running */
+  int *heap;        /* ids of the running timers, a min-heap on deadline */
+  int *pos;         /* where each id is in heap, -1 if it is not running */
+  double *deadline; /* when each running timer goes off */
+  int armed;        /* the emulator timer is running ... */
+  double armedfor;  /* ... and goes off at this time */
+};
+
+extern void lt_init(struct ltimers *, int nids);
+extern void lt_free(struct ltimers *);
+
+/* start (or restart) timer id to go off delay time units from now */
+extern void lt_start(struct sim *, struct ltimers *, int id, double delay);
+
+/* stop timer id if it is running */
+extern void lt_stop(struct ltimers *, int id);
+
+extern int lt_running(const struct ltimers *, int id);
+
+/* the entity's timer interrupt came: call this first */
+extern void lt_interrupt(struct ltimers *);
+
+/* a timer that has gone off by now, which stops running; -1 if none */
+extern int lt_expired(struct sim *, struct ltimers *);
+
+/* set the emulator timer of entity AorB for the earliest running timer; */
+/* call after starting or stopping timers */
+extern void lt_rearm(struct sim *, int AorB, struct ltimers *);
@@ -0,0 +1,184 @@
+/* Interactive front end of the network emulator: asks the user for the
+   parameters of one run, simulates it and prints the report.
+
+   -q picks the event queue engine, -r the random number generator and -s
+   its seed (9999 by default).  -w sets the transport's window, -N its
+   sequence space and -F the number of ACKs of later packets after which
+   it resends a missing packet without waiting for the timeout.  With -B
+   B sends messages too, half of them.  -Q lets the transport queue up to
+   that many messages while its window is full (-1 for no limit) instead
+   of dropping them.  -C lets it pack up to that many messages into one
+   packet.  -k turns on congestion control (see cc.c), and -c picks the
+   checksum engine the transport protects its packets with (see
+   checksum.h).  -L gives the channel a model other than the original
+   one (see channel.c), as name[:param,...] such as gilbert:0.01,0.25,1,
+   bandwidth:8,1 or reorder:0.05; "A=" or "B=" before it gives only the
+   packets A or B sends that model.  -t stops the run at the given
+   simulated time rather than at twice its expected duration, so that a
+   protocol which never goes quiet still ends (a negative time for no
+   limit).  "-r legacy" with the default seed gives the same random
+   numbers as the original srand(9999)/rand() emulator.
+
+   -R records the run's random decisions (when messages arrive, and the
+   fate of every packet) in a binary log, and -P replays such a log in
+   place of drawing them, so a run can be repeated exactly, with another
+   random number generator or a changed transport (see replay.h).
+
+   The trace is printed as it always was, unless -T names a file to write
+   it to in binary form; tracedecode prints such a file as text.
+
+   -m writes the run's metrics (latency percentiles and histograms, goodput,
+   retransmission ratio, window occupancy) to a file as JSON, or with
+   "-f csv" the latency histograms as CSV. */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "emulator.h"
+#include "evqueue.h"
+#include "rng.h"
+#include "trace.h"
+#include "checksum.h"
+#include "cc.h"
+#include "channel.h"
+
+int main(int argc, char **argv)
+{
+  struct sim_config cfg;
+  struct sim *sim;
+  const char *tracepath = NULL, *metricspath = NULL, *recordpath = NULL, *spec, *why;
+  struct chanspec chan;
+  FILE *tracefp, *fp;
+  int i, json = 1;
+
+  sim_defaults(&cfg);
+  for (i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "-q") == 0 && i + 1 < argc && evq_engine(argv[i + 1]) >= 0)
+      cfg.evqengine = evq_engine(argv[++i]);
+    else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc && rng_kind(argv[i + 1]) >= 0)
+      cfg.rng = rng_kind(argv[++i]);
+    else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+      cfg.seed = strtoull(argv[++i], NULL, 0);
+    else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc)
+      cfg.windowsize = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-N") == 0 && i + 1 < argc)
+      cfg.seqspace = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+      cfg.maxtime = atof(argv[++i]);
+    else if (strcmp(argv[i], "-F") == 0 && i + 1 < argc)
+      cfg.dupthresh = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-B") == 0)
+      cfg.bidirectional = 1;
+    else if (strcmp(argv[i], "-Q") == 0 && i + 1 < argc)
+      cfg.sendqueue = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-C") == 0 && i + 1 < argc)
+      cfg.coalesce = atoi(argv[++i]);
+    else if (strcmp(argv[i], "-k") == 0 && i + 1 < argc && cc_kind(argv[i + 1]) >= 0)
+      cfg.congestion = cc_kind(argv[++i]);
+    else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc && checksum_engine(argv[i + 1]) >= 0)
+      cfg.checksum = checksum_engine(argv[++i]);
+    else if (strcmp(argv[i], "-L") == 0 && i + 1 < argc)
+    {
+      spec = argv[++i];
+      if ((spec[0] == 'A' || spec[0] == 'B') && spec[1] == '=')
+        spec += 2;
+      if (chan_parse(spec, &chan) != 0)
+      {
+        printf("bad channel model: %s\n", argv[i]);
+        return EXIT_FAILURE;
+      }
+      if (spec == argv[i] || argv[i][0] == 'A')
+        cfg.channel[A] = chan;
+      if (spec == argv[i] || argv[i][0] == 'B')
+        cfg.channel[B] = chan;
+    }
+    else if (strcmp(argv[i], "-R") == 0 && i + 1 < argc)
+    {
+      recordpath = argv[++i];
+      cfg.record = 1;
+    }
+    else if (strcmp(argv[i], "-P") == 0 && i + 1 < argc)
+    {
+      if ((cfg.replay = fopen(argv[++i], "rb")) == NULL)
+      {
+        perror(argv[i]);
+        return EXIT_FAILURE;
+      }
+    }
+    else if (strcmp(argv[i], "-T") == 0 && i + 1 < argc)
+      tracepath = argv[++i];
+    else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc)
+      metricspath = argv[++i];
+    else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc &&
+             (strcmp(argv[i + 1], "json") == 0 || strcmp(argv[i + 1], "csv") == 0))
+      json = strcmp(argv[++i], "json") == 0;
+    else
+    {
+      printf("usage: %s [-q list|heap|calendar] [-r xoshiro|pcg|legacy] [-s seed] [-w window] [-N seqspace] [-F dupthresh] [-t maxtime] [-B] [-Q sendqueue] [-C coalesce] [-k none|aimd|vegas] [-c legacy|inet|crc32c] [-L [A=|B=]model[:params]] [-R recordlog] [-P replaylog] [-T tracefile] [-m metricsfile] [-f json|csv]\n", argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  printf("-----  Stop and Wait Network Simulator Version 1.1 -------- \n\n");
+  printf("Enter the number of messages to simulate: ");
+  scanf("%d", &cfg.nsimmax);
+  printf("Enter  packet loss probability [enter 0.0 for no loss]:");
+  scanf("%f", &cfg.lossprob);
+  printf("Enter packet corruption probability [0.0 for no corruption]:");
+  scanf("%f", &cfg.corruptprob);
+  if (cfg.lossprob != 0.0 || cfg.corruptprob != 0.0)
+  {
+    printf("If you want loss or corruption to only occur in one direction, choose the direction: 0 A->B, 1 A<-B, 2 A<->B (both directions) :");
+    scanf("%d", &cfg.corruptdirection);
+  }
+  printf("Enter average time between messages from sender's layer5 [ > 0.0]:");
+  scanf("%f", &cfg.lambda);
+  printf("Enter TRACE:");
+  scanf("%d", &cfg.trace);
+
+  tracefp = stdout;
+  if (tracepath != NULL && (tracefp = fopen(tracepath, "wb")) == NULL)
+  {
+    perror(tracepath);
+    return EXIT_FAILURE;
+  }
+
+  if ((why = sim_checkconfig(&cfg)) != NULL)
+  {
+    printf("%s.\n", why);
+    return EXIT_FAILURE;
+  }
+  sim = sim_create(&cfg);
+  if (cfg.replay != NULL)
+    fclose(cfg.replay);
+  if (sim == NULL)
+    return EXIT_FAILURE;
+  sim_tracesink(sim, tracefp, tracefp != stdout);
+  sim_run(sim);
+  sim_report(sim);
+  if (metricspath != NULL)
+  {
+    if ((fp = fopen(metricspath, "w")) == NULL)
+      perror(metricspath);
+    else
+    {
+      sim_writemetrics(sim, fp, json);
+      fclose(fp);
+    }
+  }
+  if (recordpath != NULL)
+  {
+    if ((fp = fopen(recordpath, "wb")) == NULL)
+      perror(recordpath);
+    else
+    {
+      if (sim_writelog(sim, fp) != 0)
+        perror(recordpath);
+      fclose(fp);
+    }
+  }
+  sim_destroy(sim);
+  if (tracefp != stdout)
+    fclose(tracefp);
+  return EXIT_SUCCESS;
+}
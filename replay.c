@@ -0,0 +1,185 @@
+/* Record/replay logs (see replay.h).
+
+   Each stream is a run of variable-length records, with numbers in
+   LEB128 (seven bits a byte, low bits first, the top bit set on all but
+   the last byte):
+
+   - an arrival is one number, the gap in ticks shifted left by one with
+     the entity (0 for A, 1 for B) in the low bit;
+   - a packet is a flags byte (bit 0 lost, bits 1-2 corrupt, bit 3 held
+     back, bit 4 channel bad), then unless lost the delay gap in ticks,
+     then if held back the holdback in ticks.
+
+   A log file is the magic "SRRL", a version byte, then every stream in
+   turn as its length in bytes (8 bytes, little-endian) and its records.
+   The streams are kept whole in memory, a few bytes per record, while
+   recording and replaying. */
+#include <stdlib.h>
+#include <string.h>
+#include "emulator.h"
+#include "channel.h"
+#include "replay.h"
+
+#define MAGIC "SRRL"
+#define VERSION 2
+
+#define F_LOST 1
+#define F_CORRUPT 6 /* mask */
+#define F_HELD 8
+#define F_BAD 16
+
+static void put(struct rpstream *s, unsigned char byte)
+{
+  unsigned char *buf;
+
+  if (s->len == s->cap)
+  {
+    buf = realloc(s->buf, s->cap ? 2 * s->cap : 4096);
+    if (buf == NULL)
+    {
+      printf("memory allocation for replay log failed.");
+      exit(EXIT_FAILURE);
+    }
+    s->buf = buf;
+    s->cap = s->cap ? 2 * s->cap : 4096;
+  }
+  s->buf[s->len++] = byte;
+}
+
+static void putnum(struct rpstream *s, uint64_t n)
+{
+  while (n >= 0x80)
+  {
+    put(s, (unsigned char)(n | 0x80));
+    n >>= 7;
+  }
+  put(s, (unsigned char)n);
+}
+
+/* next number of the stream; a truncated one reads as what is there */
+static uint64_t getnum(struct rpstream *s)
+{
+  uint64_t n = 0;
+  int shift = 0;
+
+  while (s->pos < s->len)
+  {
+    n |= (uint64_t)(s->buf[s->pos] & 0x7f) << shift;
+    if ((s->buf[s->pos++] & 0x80) == 0)
+      break;
+    shift += 7;
+  }
+  return n;
+}
+
+void rp_init(struct replaylog *log)
+{
+  memset(log, 0, sizeof(*log));
+}
+
+void rp_free(struct replaylog *log)
+{
+  int i;
+
+  for (i = 0; i < RP_NSTREAMS; i++)
+    free(log->streams[i].buf);
+  rp_init(log);
+}
+
+int rp_read(struct replaylog *log, FILE *fp)
+{
+  unsigned char header[sizeof(MAGIC)], len[8];
+  struct rpstream *s;
+  uint64_t n;
+  int i, j;
+
+  rp_init(log);
+  if (fread(header, 1, sizeof(header), fp) != sizeof(header) ||
+      memcmp(header, MAGIC, sizeof(MAGIC) - 1) != 0 || header[sizeof(MAGIC) - 1] != VERSION)
+    return -1;
+  for (i = 0; i < RP_NSTREAMS; i++)
+  {
+    s = &log->streams[i];
+    if (fread(len, 1, sizeof(len), fp) != sizeof(len))
+      break;
+    for (j = 7, n = 0; j >= 0; j--)
+      n = n << 8 | len[j];
+    s->len = s->cap = (size_t)n;
+    if (n > 0 && ((s->buf = malloc(s->len)) == NULL || fread(s->buf, 1, s->len, fp) != s->len))
+      break;
+  }
+  if (i < RP_NSTREAMS)
+  {
+    rp_free(log);
+    return -1;
+  }
+  return 0;
+}
+
+int rp_write(const struct replaylog *log, FILE *fp)
+{
+  unsigned char header[sizeof(MAGIC)], len[8];
+  const struct rpstream *s;
+  int i, j;
+
+  memcpy(header, MAGIC, sizeof(MAGIC) - 1);
+  header[sizeof(MAGIC) - 1] = VERSION;
+  if (fwrite(header, 1, sizeof(header), fp) != sizeof(header))
+    return -1;
+  for (i = 0; i < RP_NSTREAMS; i++)
+  {
+    s = &log->streams[i];
+    for (j = 0; j < 8; j++)
+      len[j] = (unsigned char)((uint64_t)s->len >> (8 * j));
+    if (fwrite(len, 1, sizeof(len), fp) != sizeof(len) || fwrite(s->buf, 1, s->len, fp) != s->len)
+      return -1;
+  }
+  return 0;
+}
+
+void rp_putarrival(struct replaylog *log, int64_t gap, int entity)
+{
+  putnum(&log->streams[RP_ARRIVALS], (uint64_t)gap << 1 | (entity != A));
+}
+
+void rp_putpacket(struct replaylog *log, int AorB, const struct rppacket *p)
+{
+  struct rpstream *s = &log->streams[RP_PACKETS + AorB];
+
+  put(s, (unsigned char)((p->lost ? F_LOST : 0) | p->corrupt << 1 |
+                         (!p->lost && p->delay.holdback > 0 ? F_HELD : 0) | (p->bad ? F_BAD : 0)));
+  if (p->lost)
+    return;
+  putnum(s, (uint64_t)p->delay.gap);
+  if (p->delay.holdback > 0)
+    putnum(s, (uint64_t)p->delay.holdback);
+}
+
+int rp_getarrival(struct replaylog *log, int64_t *gap, int *entity)
+{
+  struct rpstream *s = &log->streams[RP_ARRIVALS];
+  uint64_t n;
+
+  if (s->pos >= s->len)
+    return 0;
+  n = getnum(s);
+  *gap = (int64_t)(n >> 1);
+  *entity = n & 1 ? B : A;
+  return 1;
+}
+
+int rp_getpacket(struct replaylog *log, int AorB, struct rppacket *p)
+{
+  struct rpstream *s = &log->streams[RP_PACKETS + AorB];
+  int flags;
+
+  if (s->pos >= s->len)
+    return 0;
+  flags = s->buf[s->pos++];
+  p->lost = flags & F_LOST;
+  p->corrupt = (flags & F_CORRUPT) >> 1;
+  p->bad = (flags & F_BAD) != 0;
+  p->delay.gap = p->lost ? 0 : (int64_t)getnum(s);
+  p->delay.holdback = flags & F_HELD ? (int64_t)getnum(s) : 0;
+  return 1;
+}
@@ -0,0 +1,65 @@
+/* record/replay logs of the emulator's random decisions.  A recorded run */
+/* logs everything it drew at random: when each message came from layer 5 */
+/* and for which entity, and for each packet sent whether it was lost,    */
+/* which field (if any) was corrupted, the random part of its delay (see  */
+/* struct chandelay) and whether a bursty channel was bad at the time.    */
+/* A replayed run takes them from the log instead of drawing them, the    */
+/* messages in order and the packets in the order each entity sends them, */
+/* so a changed transport still sees the same channel: its nth packet     */
+/* from A meets the fate the nth one did.  Past the end of the log the    */
+/* model carries on from the state the log left it in.                    */
+#include <stdio.h>
+#include <stdint.h>
+
+#define RP_ARRIVALS 0 /* stream of the layer 5 arrivals */
+#define RP_PACKETS 1  /* stream of the packets A sends; B's follows it */
+#define RP_NSTREAMS 3
+
+/* the fate of one packet */
+struct rppacket
+{
+  int lost;
+  int corrupt;            /* 0 if not corrupted, else 1 + the field hit: */
+                          /* payload, seqnum or acknum */
+  struct chandelay delay; /* if not lost */
+  int bad;                /* the channel was bad when the packet was sent */
+                          /* (gilbert), so that a replay leaves the model */
+                          /* in the state the recorded run did */
+};
+
+/* one stream of records, each a few bytes long */
+struct rpstream
+{
+  unsigned char *buf;
+  size_t len;
+  size_t cap;
+  size_t pos; /* replay: next record */
+};
+
+struct replaylog
+{
+  struct rpstream streams[RP_NSTREAMS];
+};
+
+/* set up an empty log */
+extern void rp_init(struct replaylog *);
+
+/* release its storage */
+extern void rp_free(struct replaylog *);
+
+/* read a log written by rp_write, 0 on success */
+extern int rp_read(struct replaylog *, FILE *);
+
+/* write the log out, 0 on success */
+extern int rp_write(const struct replaylog *, FILE *);
+
+/* record the next message from layer 5, gap ticks after the previous one */
+extern void rp_putarrival(struct replaylog *, int64_t gap, int entity);
+
+/* record the next packet AorB sends */
+extern void rp_putpacket(struct replaylog *, int AorB, const struct rppacket *);
+
+/* replay the next message, or the next packet AorB sends: 1 if the log */
+/* has one, 0 if it has run out */
+extern int rp_getarrival(struct replaylog *, int64_t *gap, int *entity);
+extern int rp_getpacket(struct replaylog *, int AorB, struct rppacket *);
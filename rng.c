@@ -0,0 +1,170 @@
+/* Random number generators for the network emulator.
+
+   legacy:  the additive feedback generator behind the C library's rand()
+            (x[i] = x[i-3] + x[i-31], seeded by a 16807 LCG).  Seeded with
+            9999 it returns exactly what srand(9999)/rand() returned, so
+            runs made before the emulator had its own generator reproduce.
+   xoshiro: xoshiro256** (Blackman and Vigna), seeded through splitmix64.
+   pcg:     PCG32 with the XSH-RR output function (O'Neill).
+
+   Draws are produced a block at a time by rng_fill(); rng_uniform() in
+   rng.h hands them out one by one. */
+#include <string.h>
+#include "rng.h"
+
+#define LEGACY_DEG 31 /* degree of the additive feedback generator */
+#define LEGACY_SEP 3  /* separation of its taps */
+
+static const char *rng_names[RNG_NKINDS] = {"legacy", "xoshiro", "pcg"};
+
+int rng_kind(const char *name)
+{
+  int i;
+  for (i = 0; i < RNG_NKINDS; i++)
+    if (strcmp(name, rng_names[i]) == 0)
+      return i;
+  return -1;
+}
+
+/********************* LEGACY ******************/
+
+static uint32_t legacy_next(struct rng *r)
+{
+  uint32_t *s = r->u.legacy.s;
+  int i = r->u.legacy.pos;
+
+  s[i] += s[(i + LEGACY_DEG - LEGACY_SEP) % LEGACY_DEG];
+  r->u.legacy.pos = (i + 1) % LEGACY_DEG;
+  return s[i] >> 1;
+}
+
+static void legacy_seed(struct rng *r, uint32_t seed)
+{
+  int64_t word;
+  int i;
+
+  if (seed == 0)
+    seed = 1;
+  r->u.legacy.s[0] = seed;
+  word = (int32_t)seed;
+  for (i = 1; i < LEGACY_DEG; i++)
+  {
+    word = (16807 * word) % 2147483647;
+    if (word < 0)
+      word += 2147483647;
+    r->u.legacy.s[i] = (uint32_t)word;
+  }
+  r->u.legacy.pos = LEGACY_SEP;
+  for (i = 0; i < 10 * LEGACY_DEG; i++)
+    (void)legacy_next(r);
+}
+
+/********************* XOSHIRO256** ******************/
+
+static uint64_t rotl(uint64_t x, int k)
+{
+  return (x << k) | (x >> (64 - k));
+}
+
+static uint64_t splitmix64(uint64_t *x)
+{
+  uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+static uint64_t xoshiro_next(struct rng *r)
+{
+  uint64_t *s = r->u.xoshiro;
+  uint64_t result = rotl(s[1] * 5, 7) * 9;
+  uint64_t t = s[1] << 17;
+
+  s[2] ^= s[0];
+  s[3] ^= s[1];
+  s[1] ^= s[2];
+  s[0] ^= s[3];
+  s[2] ^= t;
+  s[3] = rotl(s[3], 45);
+  return result;
+}
+
+static void xoshiro_seed(struct rng *r, uint64_t seed, uint64_t stream)
+{
+  uint64_t x = seed;
+  int i;
+
+  /* a different splitmix64 starting point per stream */
+  x ^= splitmix64(&stream);
+  for (i = 0; i < 4; i++)
+    r->u.xoshiro[i] = splitmix64(&x);
+}
+
+/********************* PCG32 ******************/
+
+static uint32_t pcg_next(struct rng *r)
+{
+  uint64_t old = r->u.pcg.state;
+  uint32_t xorshifted = (uint32_t)(((old >> 18) ^ old) >> 27);
+  uint32_t rot = (uint32_t)(old >> 59);
+
+  r->u.pcg.state = old * 6364136223846793005ULL + r->u.pcg.inc;
+  return (xorshifted >> rot) | (xorshifted << ((32 - rot) & 31));
+}
+
+static void pcg_seed(struct rng *r, uint64_t seed, uint64_t stream)
+{
+  r->u.pcg.state = 0;
+  r->u.pcg.inc = (stream << 1) | 1;
+  (void)pcg_next(r);
+  r->u.pcg.state += seed;
+  (void)pcg_next(r);
+}
+
+/********************* COMMON ******************/
+
+void rng_seed(struct rng *r, int kind, uint64_t seed, uint64_t stream)
+{
+  r->kind = kind;
+  if (kind == RNG_LEGACY)
+    legacy_seed(r, (uint32_t)(seed + stream));
+  else if (kind == RNG_PCG)
+    pcg_seed(r, seed, stream);
+  else
+    xoshiro_seed(r, seed, stream);
+  r->next = RNG_BLOCK;
+}
+
+/* compute n fresh draws into out */
+static void generate(struct rng *r, double *out, int n)
+{
+  int i;
+
+  if (r->kind == RNG_LEGACY)
+    for (i = 0; i < n; i++)
+      out[i] = legacy_next(r) / 2147483647.0;
+  else if (r->kind == RNG_PCG)
+    for (i = 0; i < n; i++)
+      out[i] = pcg_next(r) * (1.0 / 4294967296.0);
+  else
+    for (i = 0; i < n; i++)
+      out[i] = (xoshiro_next(r) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+void rng_refill(struct rng *r)
+{
+  generate(r, r->block, RNG_BLOCK);
+  r->next = 0;
+}
+
+void rng_fill(struct rng *r, double *out, int n)
+{
+  int left = RNG_BLOCK - r->next;
+
+  /* hand out what is left of the current block first */
+  if (left > n)
+    left = n;
+  memcpy(out, r->block + r->next, left * sizeof(double));
+  r->next += left;
+  generate(r, out + left, n - left);
+}
@@ -0,0 +1,55 @@
+/* random number generators used by the emulator.  Each sim owns one      */
+/* struct rng, so runs in different threads never share generator state. */
+#include <stdint.h>
+
+#define RNG_LEGACY 0  /* the C library's rand(): reproduces srand(seed) runs */
+#define RNG_XOSHIRO 1 /* xoshiro256** */
+#define RNG_PCG 2     /* PCG32 (XSH-RR) */
+#define RNG_NKINDS 3
+
+#define RNG_BLOCK 256 /* uniform draws precomputed at a time */
+
+struct rng
+{
+  int kind;
+  union
+  {
+    struct
+    {
+      uint32_t s[31];
+      int pos;
+    } legacy;
+    uint64_t xoshiro[4];
+    struct
+    {
+      uint64_t state;
+      uint64_t inc;
+    } pcg;
+  } u;
+  double block[RNG_BLOCK]; /* precomputed draws, used from next to RNG_BLOCK */
+  int next;
+};
+
+/* map a generator name ("legacy", "xoshiro", "pcg") to RNG_*, -1 if unknown */
+extern int rng_kind(const char *name);
+
+/* seed generator kind (RNG_*) with the given seed.  Different streams of  */
+/* the same seed give independent sequences: PCG uses the stream as its   */
+/* increment, xoshiro mixes it into the splitmix64 seeding, and legacy     */
+/* is seeded with seed + stream. */
+extern void rng_seed(struct rng *, int kind, uint64_t seed, uint64_t stream);
+
+/* fill out[0..n-1] with the next n uniform draws, the same ones n calls */
+/* of rng_uniform would have returned */
+extern void rng_fill(struct rng *, double *out, int n);
+
+/* recompute the block of precomputed draws */
+extern void rng_refill(struct rng *);
+
+/* next uniform draw, in [0,1] */
+static inline double rng_uniform(struct rng *r)
+{
+  if (r->next == RNG_BLOCK)
+    rng_refill(r);
+  return r->block[r->next++];
+}
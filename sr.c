@@ -1,294 +1,899 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <math.h>
 #include "emulator.h"
 #include "sr.h"
-
-#define RTT 16.0
-#define WINDOWSIZE 6
-#define MAX_SEQ 16 /* SR needs larger sequence space (at least 2*WINDOWSIZE) */
+#include "trace.h"
+#include "ltimer.h"
+#include "checksum.h"
+#include "cc.h"
+#include "channel.h"
+
+#define RTT 16.0     /* retransmission timeout until the first RTT sample */
+#define MINRTO 1.0   /* bounds of the retransmission timeout */
+#define MAXRTO 512.0 /* or MAXRTT per packet of the window, if more */
+#define MAXRTT 20.0  /* longest round trip one queued packet adds: 10 */
+                     /* time units behind the one ahead, each way */
+#define WINDOWSIZE 6 /* default window, see sim_config */
+#define DUPTHRESH 3  /* default fast retransmit threshold, see sim_config */
+#define ACKDELAY 5.0 /* longest wait for data to piggyback an ACK on */
+#define FLUSHDELAY 2.0 /* longest a message is held back to be coalesced */
+#define MAX_SEQ 16   /* default sequence space; SR needs at least 2*WINDOWSIZE */
 #define NOTINUSE (-1)
 
-/* Sender (A) variables */
-static struct pkt buffer[WINDOWSIZE]; /* Buffer for storing packets awaiting ACK */
-static int windowfirst; /* Index of the first unacked packet in the buffer */
-static int windowcount; /* Number of packets currently awaiting an ACK */
-static int A_nextseqnum; /* Next sequence number to be used by the sender */
+/* Sequence numbers are kept as absolute 32-bit counters that wrap around
+   modulo 2^32; a packet carries the counter modulo the sequence space,
+   which is a power of two and so divides 2^32.  Distances between counters
+   are taken with unsigned arithmetic, which stays right across the wrap.
+   Both windows are rings of a power-of-two number of slots, with the packet
+   for counter n in slot n & (ringsize - 1), so sliding a window only moves
+   its base.  Which slots are done (ACKed at the sender, held at the
+   receiver) is kept in a bitmap with one bit per slot, so the run of done
+   slots at the front of a window is found a 64-bit word at a time.
+
+   An ACK carries a cumulative acknowledgement in acknum, the last packet
+   B has delivered in order, and in its payload a selective ACK (SACK)
+   bitmap of the packets B holds beyond it: bit i of the payload (bit i % 8
+   of byte i / 8) says whether B holds packet acknum + 2 + i, as packet
+   acknum + 1 is the one B is still waiting for.  The checksum covers the
+   bitmap like any payload.  A window larger than the bitmap is
+   acknowledged selectively only in its first SACKBITS + 1 packets.
+
+   In a bidirectional run both entities send data, and each runs a sender
+   for its own messages and a receiver for the other's.  A data packet
+   then also carries its sender's cumulative ACK in acknum (a pure ACK has
+   seqnum NOTINUSE, and a data packet of a one-way run acknum NOTINUSE).
+   The receiver holds back the ACK of a packet that arrived in order for
+   up to ACKDELAY, hoping to piggyback it on data of its own, and only
+   then sends it as a pure ACK.  A second packet, or one out of order,
+   is ACKed at once.
+
+   With coalescing on, a sender packs up to sr->coalesce messages into a
+   data packet, one after the other in the payload.  A new message waits
+   in the send queue for others to share its packet, as in Nagle's
+   algorithm: a full packet goes out as soon as the window has room for
+   it, but a partly filled one only when nothing else is in flight, or
+   when the oldest message held has waited FLUSHDELAY.  The receiver
+   passes the messages of a packet to layer 5 one by one.
+
+   With congestion control on (see cc.c), a sender also keeps fewer
+   packets in flight than its congestion window.  The window is told of
+   every ACK and RTT sample, and of a loss at most once per window of
+   data: a fast retransmit or timeout of a packet sent before the last
+   cut, at or beyond recover, does not cut it again. */
+
+#define MINRING 64 /* slots in a ring at least: one bitmap word */
+#define SACKBITS (8 * 20) /* bits in the payload of an ACK */
+
+/* one bit per slot of a ring */
+struct bitmap
+{
+  uint64_t *words;
+  uint32_t mask; /* slots - 1 */
+};
 
-/* Receiver (B) variables */
-static struct pkt recv_buffer[WINDOWSIZE]; /* Buffer for storing received packets at B */
-static int expectedseqnum; /* Sequence number of the next expected in-order packet */
+/* messages waiting for room in the send window, oldest first */
+struct msgqueue
+{
+  struct msg *msgs; /* ring of cap messages, cap a power of two */
+  double *times;    /* when each came from layer 5 */
+  uint32_t cap;
+  uint32_t head;
+  uint32_t count;
+};
+
+/* One entity's share of the protocol state: the sender of its own */
+/* messages and the receiver of the other entity's */
+struct entity
+{
+  /* Sender variables */
+  struct pkt *buffer;    /* Packets awaiting ACK */
+  struct bitmap acked;   /* Which of them are ACKed */
+  uint32_t windowfirst;  /* Sequence number of the first unacked packet */
+  uint32_t nextseqnum;   /* Next sequence number to be used by the sender */
+  int windowcount;       /* Number of packets currently awaiting an ACK */
+  struct ltimers timers; /* Retransmission timer of each slot, and the delayed ACK */
+  double *senttime;      /* When each slot's packet was first sent */
+  struct bitmap resent;  /* Which slots' packets have been resent */
+  double srtt;           /* Smoothed round trip time, 0 before the first sample */
+  double rttvar;         /* Its mean deviation */
+  double rto;            /* Retransmission timeout, backed off on timeouts */
+  double maxrto;         /* and its bound, long enough for a full window */
+  double lastbackoff;    /* When rto was last doubled */
+  int *beyond;           /* ACKs beyond each slot's packet while it was missing */
+  struct msgqueue queue; /* Messages waiting for the window to open */
+  struct cc cc;          /* Congestion window */
+  uint32_t recover;      /* Losses of packets before this were already answered */
+
+  /* Receiver variables */
+  struct pkt *recv_buffer; /* Packets received out of order */
+  struct bitmap held;      /* Which slots of recv_buffer hold a packet */
+  uint32_t expectedseqnum; /* Sequence number of the next expected in-order packet */
+  int heldcount;           /* Number of packets held out of order */
+  int ackpending;          /* The ACK of a packet is being held back */
+};
+
+/* Protocol state of one simulation, kept with the sim */
+struct sr
+{
+  int windowsize;    /* packets in flight (sender) or held (receiver) at most */
+  uint32_t seqmask;  /* sequence space - 1 */
+  uint32_t ringmask; /* slots in each ring - 1 */
+  int ackid;         /* timer id of the delayed ACK, after those of the slots */
+  int dupthresh;     /* ACKs beyond a missing packet that resend it, 0 for never */
+  int bidirectional; /* both entities send data */
+  int sendqueue;     /* messages a sender queues at most, negative for no limit */
+  int coalesce;      /* messages a data packet carries at most */
+  int congestion;    /* congestion control, one of CC_* */
+  int flushid;       /* timer id of the coalescing flush, after the delayed ACK */
+  checksum_fn *checksum; /* the checksum engine's function */
+  struct entity ent[2];
+};
+
+static void entity_free(struct entity *e)
+{
+  free(e->buffer);
+  free(e->recv_buffer);
+  free(e->acked.words);
+  free(e->held.words);
+  free(e->senttime);
+  free(e->resent.words);
+  free(e->beyond);
+  free(e->queue.msgs);
+  free(e->queue.times);
+  lt_free(&e->timers);
+}
 
-/* Compute the checksum of a packet for integrity verification */
-int ComputeChecksum(struct pkt packet)
+static void sr_free(void *p)
 {
-  int checksum = 0;
-  int i;
+  struct sr *sr = p;
+
+  entity_free(&sr->ent[A]);
+  entity_free(&sr->ent[B]);
+  free(sr);
+}
+
+/********* Window bitmaps ************/
+
+static void bitmap_init(struct bitmap *b, uint32_t slots)
+{
+  b->words = calloc(slots / 64, sizeof(uint64_t));
+  if (b->words == NULL)
+  {
+    printf("memory allocation for protocol state failed.");
+    exit(EXIT_FAILURE);
+  }
+  b->mask = slots - 1;
+}
+
+static int bitmap_test(const struct bitmap *b, uint32_t seq)
+{
+  seq &= b->mask;
+  return (b->words[seq >> 6] >> (seq & 63)) & 1;
+}
+
+static void bitmap_set(struct bitmap *b, uint32_t seq)
+{
+  seq &= b->mask;
+  b->words[seq >> 6] |= (uint64_t)1 << (seq & 63);
+}
+
+static void bitmap_clear(struct bitmap *b, uint32_t seq)
+{
+  seq &= b->mask;
+  b->words[seq >> 6] &= ~((uint64_t)1 << (seq & 63));
+}
+
+/* Count the set bits from seq on, up to limit, and clear them: the */
+/* length of the run of done slots at the front of a window */
+static uint32_t bitmap_takerun(struct bitmap *b, uint32_t seq, uint32_t limit)
+{
+  uint32_t run = 0, pos, n;
+  uint64_t word, ones;
+
+  while (run < limit)
+  {
+    pos = (seq + run) & b->mask;
+    word = b->words[pos >> 6] >> (pos & 63);
+    /* trailing ones of the rest of this word */
+    n = word == ~(uint64_t)0 ? 64 : (uint32_t)__builtin_ctzll(~word);
+    if (n > 64 - (pos & 63))
+      n = 64 - (pos & 63);
+    if (n > limit - run)
+      n = limit - run;
+    ones = n == 64 ? ~(uint64_t)0 : (((uint64_t)1 << n) - 1);
+    b->words[pos >> 6] &= ~(ones << (pos & 63));
+    run += n;
+    if ((pos & 63) + n < 64)
+      break; /* the run ended inside this word */
+  }
+  return run;
+}
+
+static void entity_init(struct entity *e, uint32_t ringsize)
+{
+  e->buffer = calloc(ringsize, sizeof(struct pkt));
+  e->recv_buffer = calloc(ringsize, sizeof(struct pkt));
+  bitmap_init(&e->acked, ringsize);
+  bitmap_init(&e->held, ringsize);
+  bitmap_init(&e->resent, ringsize);
+  lt_init(&e->timers, ringsize + 2);
+  e->senttime = calloc(ringsize, sizeof(double));
+  e->beyond = calloc(ringsize, sizeof(int));
+  if (e->buffer == NULL || e->recv_buffer == NULL || e->senttime == NULL || e->beyond == NULL)
+  {
+    printf("memory allocation for protocol state failed.");
+    exit(EXIT_FAILURE);
+  }
+}
+
+/* the sequence space a configuration asks for, 0 if it is not a power */
+/* of two of at least twice the window, or of more than that if either */
+/* channel reorders packets */
+static uint32_t seqspacefor(const struct sim_config *cfg)
+{
+  int windowsize = cfg->windowsize > 0 ? cfg->windowsize : WINDOWSIZE;
+  uint32_t seqspace = cfg->seqspace, least = 2 * (uint32_t)windowsize;
+
+  /* An ACK overtaken by later ones can arrive a whole window behind the */
+  /* base, where in a space of twice the window it reads the same as one */
+  /* ACKing the whole window */
+  if (cfg->channel[A].model == CHM_REORDER || cfg->channel[B].model == CHM_REORDER)
+    least++;
+  if (seqspace == 0)
+    for (seqspace = MAX_SEQ; seqspace < least; seqspace *= 2)
+      ;
+  if ((seqspace & (seqspace - 1)) != 0 || seqspace < least)
+    return 0;
+  return seqspace;
+}
+
+const char *sr_checkconfig(const struct sim_config *cfg)
+{
+  if (cfg->checksum < 0 || cfg->checksum >= CK_NENGINES)
+    return "unknown checksum engine";
+  if (cfg->congestion < 0 || cfg->congestion >= CC_NKINDS)
+    return "unknown congestion control";
+  if (cfg->coalesce > MAXCOALESCE)
+    return "a packet carries at most MAXCOALESCE (8) messages";
+  if (seqspacefor(cfg) == 0)
+    return "the sequence space must be a power of two and at least twice the window, "
+           "more with a reordering channel";
+  return NULL;
+}
+
+/* Find this simulation's protocol state, creating it on first use */
+static struct sr *sr_state(struct sim *sim)
+{
+  const struct sim_config *cfg;
+  struct sr *sr = sim_transport(sim);
+  uint32_t seqspace, ringsize;
+
+  if (sr == NULL)
+  {
+    cfg = sim_getconfig(sim);
+    sr = calloc(1, sizeof(struct sr));
+    if (sr == NULL)
+    {
+      printf("memory allocation for protocol state failed.");
+      exit(EXIT_FAILURE);
+    }
+    sr->windowsize = cfg->windowsize > 0 ? cfg->windowsize : WINDOWSIZE;
+    sr->dupthresh = cfg->dupthresh == 0 ? DUPTHRESH : cfg->dupthresh > 0 ? cfg->dupthresh : 0;
+    sr->bidirectional = cfg->bidirectional;
+    sr->sendqueue = cfg->sendqueue;
+    sr->congestion = cfg->congestion;
+    sr->coalesce = cfg->coalesce > 1 ? cfg->coalesce : 1;
+    /* coalescing holds messages in the send queue, which needs room */
+    /* for a packet's worth at least */
+    if (sr->coalesce > 1 && sr->sendqueue >= 0 && sr->sendqueue < sr->coalesce)
+      sr->sendqueue = sr->coalesce;
+    sr->checksum = checksum_func(cfg->checksum);
+    seqspace = seqspacefor(cfg); /* sim_create checked it */
+    sr->seqmask = seqspace - 1;
+    for (ringsize = MINRING; ringsize < (uint32_t)sr->windowsize; ringsize *= 2)
+      ;
+    sr->ringmask = ringsize - 1;
+    sr->ackid = (int)ringsize;
+    sr->flushid = (int)ringsize + 1;
+    entity_init(&sr->ent[A], ringsize);
+    entity_init(&sr->ent[B], ringsize);
+    sim_settransport(sim, sr, sr_free);
+  }
+  return sr;
+}
 
-  checksum = packet.seqnum;
-  checksum += packet.acknum;
-  for (i = 0; i < 20; i++)
-    checksum += (int)(packet.payload[i]);
+/* the absolute sequence number at or after base that a packet's seqnum */
+/* or acknum stands for */
+static uint32_t unwrap(struct sr *sr, int seqnum, uint32_t base)
+{
+  return base + (((uint32_t)seqnum - base) & sr->seqmask);
+}
 
-  return checksum;
+/* Compute the checksum of a packet for integrity verification, with */
+/* the engine the run was configured with (see checksum.h) */
+static int ComputeChecksum(const struct sr *sr, const struct pkt *packet)
+{
+  return sr->checksum(packet);
 }
 
 /* Check if a packet is corrupted by comparing checksums */
-int IsCorrupted(struct pkt packet)
+static int IsCorrupted(const struct sr *sr, const struct pkt *packet)
 {
-  if (packet.checksum == ComputeChecksum(packet))
+  if (packet->checksum == ComputeChecksum(sr, packet))
     return -1; /* Uncorrupted */
   else
     return 0; /* Corrupted */
 }
 
-/********* Sender (A) functions ************/
+/* Copy the part of a packet in use */
+static void pktcopy(struct pkt *to, const struct pkt *from)
+{
+  memcpy(to, from, PKT_SIZE(from));
+}
+
+/********* Sending ************/
+
+/* Send a packet of entity AorB's sender to layer 3, copying it once */
+/* from the send buffer straight into the emulator's storage.  In a */
+/* bidirectional run it carries the entity's latest cumulative ACK, */
+/* which makes any ACK being held back unnecessary. */
+static void transmit(struct sim *sim, struct sr *sr, int AorB, const struct pkt *packet)
+{
+  struct entity *e = &sr->ent[AorB];
+  struct pkt *out;
+
+  out = tolayer3_begin(sim);
+  pktcopy(out, packet);
+  sim_stats(sim)->pktcopies++;
+  if (sr->bidirectional)
+  {
+    out->acknum = (int)((e->expectedseqnum - 1) & sr->seqmask);
+    out->checksum = ComputeChecksum(sr, out);
+    if (e->ackpending)
+    {
+      e->ackpending = 0;
+      lt_stop(&e->timers, sr->ackid);
+      sim_stats(sim)->piggybacked[AorB]++;
+    }
+  }
+  tolayer3_commit(sim, AorB);
+}
 
-/* Called from layer 5: Send a new message to the network */
-void A_output(struct msg message)
+/* Send a pure ACK of everything entity AorB's receiver has: cumulatively */
+/* up to the packet still awaited, selectively for the ones held beyond it. */
+/* It is built in the emulator's storage. */
+static void sendack(struct sim *sim, struct sr *sr, int AorB)
 {
-  struct pkt sendpkt;
+  struct entity *e = &sr->ent[AorB];
+  struct pkt *sendpkt;
   int i;
-  int index;
-  /* Compute the sequence number range of the current window */
-  int seqfirst = windowfirst;
-  int seqlast = (windowfirst + WINDOWSIZE - 1) % MAX_SEQ;
-
-  /* Check if A_nextseqnum is within the current window */
-  if (((seqfirst <= seqlast) && (A_nextseqnum >= seqfirst && A_nextseqnum <= seqlast)) ||
-      ((seqfirst > seqlast) && (A_nextseqnum >= seqfirst || A_nextseqnum <= seqlast)))
+
+  sendpkt = tolayer3_begin(sim);
+  sendpkt->acknum = (int)((e->expectedseqnum - 1) & sr->seqmask);
+  sendpkt->seqnum = NOTINUSE;
+  sendpkt->length = SACKBITS / 8;
+  memset(sendpkt->payload, 0, SACKBITS / 8);
+  for (i = 0; i < SACKBITS && i + 1 < sr->windowsize; i++)
+    if (bitmap_test(&e->held, e->expectedseqnum + 1 + i))
+      sendpkt->payload[i / 8] |= (char)(1 << (i % 8));
+  sendpkt->checksum = ComputeChecksum(sr, sendpkt);
+  if (e->ackpending)
   {
-    if (TRACE > 1)
-      printf("----A: New message arrives, send window is not full, send new messge to layer3!\n");
-
-    /* Create a new packet with the given message */
-    sendpkt.seqnum = A_nextseqnum;
-    sendpkt.acknum = NOTINUSE;
-    for (i = 0; i < 20; i++)
-      sendpkt.payload[i] = message.data[i];
-    sendpkt.checksum = ComputeChecksum(sendpkt);
-
-    /* Calculate the buffer index based on the sequence number */
-    if (A_nextseqnum >= seqfirst)
-      index = A_nextseqnum - seqfirst;
-    else
-      index = WINDOWSIZE - seqfirst + A_nextseqnum;
-    buffer[index] = sendpkt;
-    windowcount++;
+    e->ackpending = 0;
+    lt_stop(&e->timers, sr->ackid);
+  }
+  sim_stats(sim)->acks_sent[AorB]++;
+  tolayer3_commit(sim, AorB);
+}
 
-    /* Send the packet to layer 3 */
-    if (TRACE > 0)
-      printf("Sending packet %d to layer 3\n", sendpkt.seqnum);
-    tolayer3(A, sendpkt);
+/********* Send queue ************/
 
-    /* Start the timer if this is the first packet in the window */
-    if (A_nextseqnum == seqfirst)
-      starttimer(A, RTT);
+static void queue_push(struct msgqueue *q, const struct msg *message, double time)
+{
+  struct msg *msgs;
+  double *times;
+  uint32_t i, cap;
 
-    /* Increment the next sequence number */
-    A_nextseqnum = (A_nextseqnum + 1) % MAX_SEQ;
+  if (q->count == q->cap)
+  {
+    cap = q->cap ? 2 * q->cap : 64;
+    msgs = malloc(cap * sizeof(struct msg));
+    times = malloc(cap * sizeof(double));
+    if (msgs == NULL || times == NULL)
+    {
+      printf("memory allocation for send queue failed.");
+      exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < q->count; i++)
+    {
+      msgs[i] = q->msgs[(q->head + i) & (q->cap - 1)];
+      times[i] = q->times[(q->head + i) & (q->cap - 1)];
+    }
+    free(q->msgs);
+    free(q->times);
+    q->msgs = msgs;
+    q->times = times;
+    q->cap = cap;
+    q->head = 0;
   }
+  q->msgs[(q->head + q->count) & (q->cap - 1)] = *message;
+  q->times[(q->head + q->count) & (q->cap - 1)] = time;
+  q->count++;
+}
+
+/* take the oldest message off the queue into data, returning when it */
+/* was queued */
+static double queue_pop(struct msgqueue *q, char *data)
+{
+  double time = q->times[q->head];
+
+  memcpy(data, q->msgs[q->head].data, sizeof(struct msg));
+  q->head = (q->head + 1) & (q->cap - 1);
+  q->count--;
+  return time;
+}
+
+/********* Sender functions ************/
+
+/* Send a new packet of entity AorB, for which the window has room: with */
+/* the given message, or with message NULL the next n queued ones */
+static void sendnew(struct sim *sim, struct sr *sr, int AorB, const struct msg *message, int n)
+{
+  struct entity *e = &sr->ent[AorB];
+  struct pkt *sendpkt;
+  uint32_t slot;
+  int i;
+
+  TRACEPOINT(sim, TR_A_SEND, AorB, (int)(e->nextseqnum & sr->seqmask), 0, 0, 0.0, NULL);
+
+  /* Create a new packet with the messages in its slot, where it is */
+  /* kept until it is ACKed */
+  slot = e->nextseqnum & sr->ringmask;
+  sendpkt = &e->buffer[slot];
+  sendpkt->seqnum = (int)(e->nextseqnum & sr->seqmask);
+  sendpkt->acknum = NOTINUSE;
+  if (message != NULL)
+    memcpy(sendpkt->payload, message->data, sizeof(struct msg));
   else
+    for (i = 0; i < n; i++)
+      sim_dequeued(sim, AorB, sim_now(sim) - queue_pop(&e->queue, &sendpkt->payload[i * sizeof(struct msg)]));
+  sendpkt->length = n * (int)sizeof(struct msg);
+  sendpkt->checksum = ComputeChecksum(sr, sendpkt);
+  e->windowcount++;
+  sim_window(sim, AorB, e->windowcount);
+  sim_stats(sim)->datapackets[AorB]++;
+  sim_stats(sim)->datamsgs[AorB] += n;
+
+  /* Send the packet to layer 3 */
+  TRACEPOINT(sim, TR_A_SENDING, AorB, sendpkt->seqnum, sendpkt->acknum, sendpkt->checksum, 0.0, sendpkt->payload);
+  transmit(sim, sr, AorB, sendpkt);
+
+  /* Start the packet's own retransmission timer */
+  e->senttime[slot] = sim_now(sim);
+  bitmap_clear(&e->resent, slot);
+  e->beyond[slot] = 0;
+  lt_start(sim, &e->timers, slot, e->rto);
+  lt_rearm(sim, AorB, &e->timers);
+
+  /* Increment the next sequence number */
+  e->nextseqnum++;
+}
+
+/* Whether entity AorB's sender may send a new packet: its window has */
+/* room for it, and fewer packets than the congestion window are in flight */
+static int hasroom(const struct sr *sr, const struct entity *e)
+{
+  return e->nextseqnum - e->windowfirst < (uint32_t)sr->windowsize && e->windowcount < cc_window(&e->cc);
+}
+
+/* Entity AorB's congestion window may have changed from before: report */
+/* it to the emulator, counting cuts */
+static void cwndupdate(struct sim *sim, int AorB, struct entity *e, double before)
+{
+  if (e->cc.cwnd == before)
+    return;
+  if (e->cc.cwnd < before)
+    sim_stats(sim)->cwndcuts[AorB]++;
+  TRACEPOINT(sim, TR_A_CWND, AorB, e->windowcount, 0, 0, e->cc.cwnd, NULL);
+  sim_cwnd(sim, AorB, e->cc.cwnd);
+}
+
+/* A packet of entity AorB, seq, was found lost: cut the congestion */
+/* window, unless a loss of this window of data was answered already */
+static void congestion(struct sim *sim, int AorB, struct entity *e, uint32_t seq, int timeout)
+{
+  double before = e->cc.cwnd;
+
+  if ((int32_t)(seq - e->recover) < 0)
+    return;
+  cc_loss(&e->cc, timeout);
+  e->recover = e->nextseqnum;
+  cwndupdate(sim, AorB, e, before);
+}
+
+/* Send what entity AorB's send queue holds while the window has room: */
+/* packets of sr->coalesce messages, and one with fewer only if nothing */
+/* else is in flight or force is set.  While messages are held back */
+/* with room in the window the flush timer runs, so that none of them */
+/* waits longer than FLUSHDELAY. */
+static void flush(struct sim *sim, struct sr *sr, int AorB, int force)
+{
+  struct entity *e = &sr->ent[AorB];
+  uint32_t n;
+  int sent = 0;
+
+  while (e->queue.count > 0 && hasroom(sr, e))
+  {
+    n = e->queue.count < (uint32_t)sr->coalesce ? e->queue.count : (uint32_t)sr->coalesce;
+    if (n < (uint32_t)sr->coalesce && e->windowcount > 0 && !force)
+      break;
+    sendnew(sim, sr, AorB, NULL, (int)n);
+    sent = 1;
+  }
+  if (sent)
+    sim_queue(sim, AorB, (int)e->queue.count);
+  if (sr->coalesce > 1)
   {
-    if (TRACE > 0)
-      printf("----A: New message arrives, send window is full\n");
-    window_full++;
+    if (e->queue.count == 0 || !hasroom(sr, e))
+      lt_stop(&e->timers, sr->flushid);
+    else if (!lt_running(&e->timers, sr->flushid))
+      lt_start(sim, &e->timers, sr->flushid, FLUSHDELAY);
+    lt_rearm(sim, AorB, &e->timers);
   }
 }
 
-/* Called from layer 3: Process an incoming ACK packet */
-void A_input(struct pkt packet)
+/* Called from layer 5: Send a new message of entity AorB to the network, */
+/* or queue it while the window is full or to be coalesced with the next */
+/* ones; 0 (backpressure) if it has to be dropped because the queue is */
+/* full too */
+static int output(struct sim *sim, int AorB, struct msg message)
 {
-  int ackcount = 0;
-  int i;
-  int seqfirst;
-  int seqlast;
-  int index;
+  struct sr *sr = sr_state(sim);
+  struct entity *e = &sr->ent[AorB];
+  int room = hasroom(sr, e);
 
-  /* Check if the received ACK is not corrupted */
-  if (IsCorrupted(packet) == -1)
+  /* Check if nextseqnum is within the current window, and whether the */
+  /* message goes alone */
+  if (room && e->queue.count == 0 && (sr->coalesce == 1 || e->windowcount == 0))
+  {
+    sendnew(sim, sr, AorB, &message, 1);
+    return 1;
+  }
+  else if (sr->sendqueue < 0 || e->queue.count < (uint32_t)sr->sendqueue)
+  {
+    if (room)
+      TRACEPOINT(sim, TR_A_HOLD, AorB, 0, 0, 0, 0.0, NULL);
+    else
+      TRACEPOINT(sim, TR_A_QUEUED, AorB, 0, 0, 0, 0.0, NULL);
+    queue_push(&e->queue, &message, sim_now(sim));
+    sim_queue(sim, AorB, (int)e->queue.count);
+    if (room)
+      flush(sim, sr, AorB, 0);
+    return 1;
+  }
+  else
   {
-    if (TRACE > 0)
-      printf("----A: uncorrupted ACK %d is received\n", packet.acknum);
-    total_ACKs_received++;
+    TRACEPOINT(sim, TR_A_FULL, AorB, 0, 0, 0, 0.0, NULL);
+    sim_stats(sim)->window_full++;
+    return 0;
+  }
+}
 
-    /* Compute the current window's sequence number range */
-    seqfirst = windowfirst;
-    seqlast = (windowfirst + WINDOWSIZE - 1) % MAX_SEQ;
+/* Fold a round trip time measurement into the estimate and set the */
+/* retransmission timeout from it, as TCP does (RFC 6298).  This also */
+/* undoes any backoff. */
+static void rttsample(struct entity *e, double rtt)
+{
+  if (e->srtt == 0.0)
+  {
+    e->srtt = rtt;
+    e->rttvar = rtt / 2;
+  }
+  else
+  {
+    e->rttvar = 0.75 * e->rttvar + 0.25 * fabs(e->srtt - rtt);
+    e->srtt = 0.875 * e->srtt + 0.125 * rtt;
+  }
+  e->rto = e->srtt + 4 * e->rttvar;
+  cc_rtt(&e->cc, rtt);
+  if (e->rto < MINRTO)
+    e->rto = MINRTO;
+  if (e->rto > e->maxrto)
+    e->rto = e->maxrto;
+}
 
-    /* Check if the ACK is within the current window */
-    if (((seqfirst <= seqlast) && (packet.acknum >= seqfirst && packet.acknum <= seqlast)) ||
-        ((seqfirst > seqlast) && (packet.acknum >= seqfirst || packet.acknum <= seqlast)))
-    {
-      /* Calculate the buffer index for the ACK */
-      if (packet.acknum >= seqfirst)
-        index = packet.acknum - seqfirst;
-      else
-        index = WINDOWSIZE - seqfirst + packet.acknum;
-
-      /* Check if this is a new ACK */
-      if (buffer[index].acknum == NOTINUSE)
+/* Mark packet seq as ACKed and stop its timer, if it is in flight and */
+/* not already ACKed; 1 if it was newly ACKed */
+static int ackpacket(struct sr *sr, struct entity *e, uint32_t seq)
+{
+  if (seq - e->windowfirst >= e->nextseqnum - e->windowfirst || bitmap_test(&e->acked, seq))
+    return 0;
+  bitmap_set(&e->acked, seq);
+  e->windowcount--;
+  lt_stop(&e->timers, seq & sr->ringmask);
+  return 1;
+}
+
+/* Process the ACK an uncorrupted packet to entity AorB carries, with a */
+/* SACK bitmap if it is a pure ACK */
+static void ackinput(struct sim *sim, struct sr *sr, int AorB, const struct pkt *packet)
+{
+  struct entity *e = &sr->ent[AorB];
+  uint32_t cum, seq, n, i, sampled = 0, highest;
+  int sack = packet->seqnum == NOTINUSE;
+  struct pkt *resend;
+  double before;
+  int newacks = 0;
+
+  TRACEPOINT(sim, TR_A_ACK, AorB, packet->seqnum, packet->acknum, packet->checksum, 0.0, NULL);
+  sim_stats(sim)->total_ACKs_received++;
+
+  /* Everything before the packet the receiver is waiting for is ACKed, */
+  /* and so is every later packet whose SACK bit is set; an ACK from */
+  /* before the window's base says nothing new.  One from behind it */
+  /* lands past nextseqnum here, as the sequence space is more than */
+  /* twice the window whenever ACKs can come back out of order */
+  cum = unwrap(sr, packet->acknum + 1, e->windowfirst);
+  if (cum - e->windowfirst <= e->nextseqnum - e->windowfirst)
+  {
+    for (seq = e->windowfirst; seq != cum; seq++)
+      if (ackpacket(sr, e, seq))
       {
-        if (TRACE > 0)
-          printf("----A: ACK %d is not a duplicate\n", packet.acknum);
-        new_ACKs++;
-        windowcount--;
-        buffer[index].acknum = packet.acknum;
+        newacks++;
+        sampled = seq + 1;
       }
-      else
+    n = cum == e->nextseqnum || !sack ? 0 : e->nextseqnum - cum - 1;
+    highest = cum;
+    for (i = 0; i < n && i < SACKBITS; i++)
+      if ((packet->payload[i / 8] >> (i % 8)) & 1)
       {
-        if (TRACE > 0)
-          printf("----A: duplicate ACK received, do nothing!\n");
+        highest = cum + 1 + i;
+        if (ackpacket(sr, e, cum + 1 + i))
+        {
+          newacks++;
+          sampled = cum + 2 + i;
+        }
       }
 
-      /* If the ACK is for the first packet in the window, slide the window */
-      if (packet.acknum == seqfirst)
+    /* Fast retransmit: every packet still missing below the highest */
+    /* one the receiver holds has been passed by one more ACK, and is */
+    /* resent without waiting for its timer once dupthresh ACKs passed it */
+    for (seq = cum; sr->dupthresh > 0 && seq != highest; seq++)
+      if (!bitmap_test(&e->acked, seq) && ++e->beyond[seq & sr->ringmask] == sr->dupthresh)
       {
-        /* Count consecutive ACKs starting from the window's base */
-        for (i = 0; i < WINDOWSIZE; i++)
-        {
-          if (buffer[i].acknum != NOTINUSE && buffer[i].seqnum >= 0)
-            ackcount++;
-          else
-            break;
-        }
+        resend = &e->buffer[seq & sr->ringmask];
+        TRACEPOINT(sim, TR_A_FASTRETX, AorB, resend->seqnum, resend->acknum, resend->checksum, 0.0, resend->payload);
+        transmit(sim, sr, AorB, resend);
+        sim_stats(sim)->packets_resent++;
+        sim_stats(sim)->fast_retransmits++;
+        bitmap_set(&e->resent, seq);
+        lt_start(sim, &e->timers, seq & sr->ringmask, e->rto);
+        congestion(sim, AorB, e, seq, 0);
+      }
+  }
 
-        /* Slide the window by updating windowfirst */
-        windowfirst = (windowfirst + ackcount) % MAX_SEQ;
+  lt_rearm(sim, AorB, &e->timers);
+  if (newacks > 0)
+  {
+    TRACEPOINT(sim, TR_A_NEWACK, AorB, packet->seqnum, packet->acknum, packet->checksum, 0.0, NULL);
+    sim_stats(sim)->new_ACKs++;
+    sim_window(sim, AorB, e->windowcount);
+
+    /* The latest packet the ACK covers is most likely the one whose */
+    /* arrival sent it; only a packet sent once gives a true RTT */
+    /* sample (Karn) */
+    if (!bitmap_test(&e->resent, sampled - 1))
+      rttsample(e, sim_now(sim) - e->senttime[(sampled - 1) & sr->ringmask]);
+    before = e->cc.cwnd;
+    cc_ack(&e->cc, newacks, sim_now(sim));
+    cwndupdate(sim, AorB, e, before);
+
+    /* Slide the window past every ACKed packet at its front, and fill */
+    /* the room that makes from the send queue */
+    e->windowfirst += bitmap_takerun(&e->acked, e->windowfirst, e->nextseqnum - e->windowfirst);
+    flush(sim, sr, AorB, 0);
+  }
+  else
+    TRACEPOINT(sim, TR_A_DUPACK, AorB, packet->seqnum, packet->acknum, packet->checksum, 0.0, NULL);
+}
 
-        /* Shift the buffer to remove ACKed packets */
-        for (i = 0; i < WINDOWSIZE; i++)
-        {
-          if (buffer[i + ackcount].acknum == NOTINUSE || (buffer[i].seqnum + ackcount) % MAX_SEQ == A_nextseqnum)
-            buffer[i] = buffer[i + ackcount];
-        }
+/* Called when entity AorB's timer expires: Resend every packet whose */
+/* own timer has gone off, and send an ACK held back for too long */
+static void timerinterrupt(struct sim *sim, int AorB)
+{
+  struct sr *sr = sr_state(sim);
+  struct entity *e = &sr->ent[AorB];
+  struct pkt *packet;
+  double now = sim_now(sim);
+  int slot;
+
+  lt_interrupt(&e->timers);
+  while ((slot = lt_expired(sim, &e->timers)) >= 0)
+  {
+    if (slot == sr->ackid)
+    {
+      sendack(sim, sr, AorB);
+      continue;
+    }
+    if (slot == sr->flushid)
+    {
+      flush(sim, sr, AorB, 1);
+      continue;
+    }
 
-        /* Restart the timer if there are still unacked packets */
-        stoptimer(A);
-        if (windowcount > 0)
-          starttimer(A, RTT);
-      }
-      else
-      {
-        /* Update buffer with the ACK */
-        buffer[index].acknum = packet.acknum;
-      }
+    /* Back off, but only once per timeout period however many */
+    /* packets time out in it */
+    if (now - e->lastbackoff >= e->rto)
+    {
+      e->rto = e->rto * 2 < e->maxrto ? e->rto * 2 : e->maxrto;
+      e->lastbackoff = now;
+    }
+    packet = &e->buffer[slot];
+    TRACEPOINT(sim, TR_A_TIMEOUT, AorB, packet->seqnum, packet->acknum, packet->checksum, e->rto, packet->payload);
+    transmit(sim, sr, AorB, packet);
+    sim_stats(sim)->packets_resent++;
+    bitmap_set(&e->resent, slot);
+    lt_start(sim, &e->timers, slot, e->rto);
+    congestion(sim, AorB, e, e->windowfirst + (((uint32_t)slot - e->windowfirst) & sr->ringmask), 1);
+  }
+  lt_rearm(sim, AorB, &e->timers);
+}
+
+/********* Receiver functions ************/
+
+/* Pass the messages of a data packet to layer 5 at entity AorB */
+static void deliver(struct sim *sim, int AorB, const struct pkt *packet)
+{
+  int i, n = packet->length < (int)sizeof(packet->payload) ? packet->length : (int)sizeof(packet->payload);
+
+  for (i = 0; i + (int)sizeof(struct msg) <= n; i += sizeof(struct msg))
+    tolayer5(sim, AorB, &packet->payload[i]);
+}
+
+/* Process an uncorrupted data packet to entity AorB */
+static void datainput(struct sim *sim, struct sr *sr, int AorB, const struct pkt *packet)
+{
+  struct entity *e = &sr->ent[AorB];
+  uint32_t seq, run;
+  int inorder = 0;
+
+  TRACEPOINT(sim, TR_B_RECV, AorB, packet->seqnum, packet->acknum, packet->checksum, 0.0, packet->payload);
+  sim_stats(sim)->packets_received++;
+
+  /* Take the packet if it is within the receiver's window and new; */
+  /* anything else is a resend of a packet already delivered, which */
+  /* the sender need not have made.  The one awaited is delivered */
+  /* straight from the emulator's storage; only packets beyond it are */
+  /* copied, to be held until the gap before them fills. */
+  seq = unwrap(sr, packet->seqnum, e->expectedseqnum);
+  if (seq - e->expectedseqnum < (uint32_t)sr->windowsize)
+  {
+    if (bitmap_test(&e->held, seq))
+      sim_stats(sim)->spurious_resends++;
+    else if (seq == e->expectedseqnum)
+    {
+      deliver(sim, AorB, packet);
+      e->expectedseqnum++;
+      inorder = 1;
+    }
+    else
+    {
+      pktcopy(&e->recv_buffer[seq & sr->ringmask], packet);
+      sim_stats(sim)->pktcopies++;
+      bitmap_set(&e->held, seq);
+      e->heldcount++;
+    }
+
+    /* Deliver every packet now in order to the application and */
+    /* slide the window past them */
+    run = bitmap_takerun(&e->held, e->expectedseqnum, sr->windowsize);
+    e->heldcount -= run;
+    for (; run > 0; run--)
+    {
+      deliver(sim, AorB, &e->recv_buffer[e->expectedseqnum & sr->ringmask]);
+      e->expectedseqnum++;
     }
   }
   else
+    sim_stats(sim)->spurious_resends++;
+
+  /* ACK at once, unless the packet arrived in order with nothing held */
+  /* beyond it and data of this entity's own may soon carry the ACK */
+  if (sr->bidirectional && inorder && e->heldcount == 0 && !e->ackpending)
   {
-    if (TRACE > 0)
-      printf("----A: corrupted ACK is received, do nothing!\n");
+    e->ackpending = 1;
+    lt_start(sim, &e->timers, sr->ackid, ACKDELAY);
   }
+  else
+    sendack(sim, sr, AorB);
+  lt_rearm(sim, AorB, &e->timers);
 }
 
-/* Called when the timer expires: Resend the oldest unacknowledged packet */
-void A_timerinterrupt(void)
+/* Called from layer 3: Process a packet arriving at entity AorB */
+static void input(struct sim *sim, int AorB, const struct pkt *packet)
 {
-  if (TRACE > 0)
+  struct sr *sr = sr_state(sim);
+
+  /* Check if the received packet is not corrupted; an ACK piggybacked */
+  /* on data only matters while this entity has packets in flight */
+  if (IsCorrupted(sr, packet) == -1)
+  {
+    if (packet->acknum != NOTINUSE && (packet->seqnum == NOTINUSE || sr->ent[AorB].windowcount > 0))
+      ackinput(sim, sr, AorB, packet);
+    if (packet->seqnum != NOTINUSE)
+      datainput(sim, sr, AorB, packet);
+  }
+  else if (sr->bidirectional || AorB == A)
   {
-    printf("----A: time out,resend packets!\n");
-    printf("---A: resending packet %d\n", buffer[0].seqnum);
+    /* (B of a one-way run only ever receives data) */
+    TRACEPOINT(sim, TR_A_BADACK, AorB, packet->seqnum, packet->acknum, packet->checksum, 0.0, NULL);
   }
-  tolayer3(A, buffer[0]);
-  packets_resent++;
-  starttimer(A, RTT);
 }
 
-/* Initialize sender's state variables */
-void A_init(void)
+/* Initialize entity AorB's sender and receiver */
+static void init(struct sim *sim, int AorB)
 {
-  A_nextseqnum = 0;
-  windowfirst = 0;
-  windowcount = 0;
+  struct sr *sr = sr_state(sim);
+  struct entity *e = &sr->ent[AorB];
+
+  e->nextseqnum = 0;
+  e->windowfirst = 0;
+  e->windowcount = 0;
+  e->srtt = 0.0;
+  e->rttvar = 0.0;
+  e->rto = RTT;
+  /* a full window queued in the channel must not outlast the timeout */
+  e->maxrto = MAXRTT * sr->windowsize > MAXRTO ? MAXRTT * sr->windowsize : MAXRTO;
+  e->lastbackoff = 0.0;
+  e->expectedseqnum = 0;
+  e->heldcount = 0;
+  e->ackpending = 0;
+  e->recover = 0;
+  cc_init(&e->cc, sr->congestion, sr->windowsize);
+  if (sr->congestion != CC_NONE)
+    sim_cwnd(sim, AorB, e->cc.cwnd);
 }
 
-/********* Receiver (B) functions ************/
+/********* Entry points of A and B ************/
 
-/* Called from layer 3: Process an incoming packet at B */
-void B_input(struct pkt packet)
+int A_output(struct sim *sim, struct msg message)
 {
-  int pckcount = 0;
-  struct pkt sendpkt;
-  int i;
-  int seqfirst;
-  int seqlast;
-  int index;
+  return output(sim, A, message);
+}
 
-  /* Check if the received packet is not corrupted */
-  if (IsCorrupted(packet) == -1)
-  {
-    if (TRACE > 0)
-      printf("----B: packet %d is correctly received, send ACK!\n", packet.seqnum);
-    packets_received++;
-
-    /* Send an ACK for the received packet */
-    sendpkt.acknum = packet.seqnum;
-    sendpkt.seqnum = NOTINUSE;
-    for (i = 0; i < 20; i++)
-      sendpkt.payload[i] = '0';
-    sendpkt.checksum = ComputeChecksum(sendpkt);
-    tolayer3(B, sendpkt);
-
-    /* Compute the receiver's window range */
-    seqfirst = expectedseqnum;
-    seqlast = (expectedseqnum + WINDOWSIZE - 1) % MAX_SEQ;
-
-    /* Check if the packet is within the receiver's window */
-    if (((seqfirst <= seqlast) && (packet.seqnum >= seqfirst && packet.seqnum <= seqlast)) ||
-        ((seqfirst > seqlast) && (packet.seqnum >= seqfirst || packet.seqnum <= seqlast)))
-    {
-      /* Calculate the buffer index for the packet */
-      if (packet.seqnum >= seqfirst)
-        index = packet.seqnum - seqfirst;
-      else
-        index = WINDOWSIZE - seqfirst + packet.seqnum;
-
-      /* If not a duplicate (compare payloads), store the packet */
-      if (strcmp(recv_buffer[index].payload, packet.payload) != 0)
-      {
-        packet.acknum = packet.seqnum;
-        recv_buffer[index] = packet;
+void A_input(struct sim *sim, const struct pkt *packet)
+{
+  input(sim, A, packet);
+}
 
-        /* If the packet is the expected one, slide the window */
-        if (packet.seqnum == seqfirst)
-        {
-          for (i = 0; i < WINDOWSIZE; i++)
-          {
-            if (recv_buffer[i].acknum >= 0 && strcmp(recv_buffer[i].payload, "") != 0)
-              pckcount++;
-            else
-              break;
-          }
-
-          /* Update the expected sequence number */
-          expectedseqnum = (expectedseqnum + pckcount) % MAX_SEQ;
-
-          /* Shift the buffer to remove delivered packets */
-          for (i = 0; i < WINDOWSIZE; i++)
-          {
-            if (i + pckcount < WINDOWSIZE)
-              recv_buffer[i] = recv_buffer[i + pckcount];
-          }
-        }
+void A_timerinterrupt(struct sim *sim)
+{
+  timerinterrupt(sim, A);
+}
 
-        /* Deliver the packet to the application */
-        tolayer5(B, packet.payload);
-      }
-    }
-  }
+void A_init(struct sim *sim)
+{
+  init(sim, A);
 }
 
-/* Initialize receiver's state variables */
-void B_init(void)
+int B_output(struct sim *sim, struct msg message)
 {
-  expectedseqnum = 0;
+  return output(sim, B, message);
 }
 
-void B_output(struct msg message)
+void B_input(struct sim *sim, const struct pkt *packet)
 {
+  input(sim, B, packet);
 }
 
-void B_timerinterrupt(void)
+void B_timerinterrupt(struct sim *sim)
 {
-}
\ No newline at end of file
+  timerinterrupt(sim, B);
+}
+
+void B_init(struct sim *sim)
+{
+  init(sim, B);
+}
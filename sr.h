@@ -1,11 +1,16 @@
-extern void A_init(void);
-extern void B_init(void);
-extern void A_input(struct pkt);
-extern void B_input(struct pkt);
-extern void A_output(struct msg);
-extern void A_timerinterrupt(void);
+/* NULL if the transport can run with the configuration, else why not */
+extern const char *sr_checkconfig(const struct sim_config *);
 
-/* included for extension to bidirectional communication */
-#define BIDIRECTIONAL 0
-extern void B_output(struct msg);
-extern void B_timerinterrupt(void);
\ No newline at end of file
+extern void A_init(struct sim *);
+extern void B_init(struct sim *);
+/* A_input and B_input are given the packet in the emulator's storage */
+extern void A_input(struct sim *, const struct pkt *);
+extern void B_input(struct sim *, const struct pkt *);
+/* A_output and B_output return 1 if they took the message, 0 if it was */
+/* dropped (e.g. because the send window is full) */
+extern int A_output(struct sim *, struct msg);
+extern void A_timerinterrupt(struct sim *);
+
+/* B sends data too in bidirectional runs (see sim_config) */
+extern int B_output(struct sim *, struct msg);
+extern void B_timerinterrupt(struct sim *);
\ No newline at end of file
@@ -0,0 +1,449 @@
+/* Parameter sweep runner: simulates every point of a grid of emulator
+   parameters on a pool of threads and prints one table of results.
+
+   usage: sweep [-j threads] [-f csv|json] [-o file] [-s seed] [-r rng]
+                [-q engine] [-c checksum] [-t maxtime] [-g spec]... [gridfile]
+
+   A grid is given by "key=values" specs, either with -g on the command line
+   or one per line in a grid file ('#' starts a comment).  values is a comma
+   separated list and/or start:stop:step ranges, e.g.
+
+     messages=10000
+     loss=0:0.3:0.05
+     corrupt=0,0.1,0.2
+     direction=2
+     lambda=5,10,20
+     window=8,64,512
+     dupthresh=-1,1,3
+     bidirectional=0,1
+     sendqueue=0,100,-1
+     coalesce=1,4,8
+     congestion=0,1,2
+     channel=0,1,2,3
+
+   Keys not given keep a single default value.  -t stops every run at the
+   given simulated time instead of at twice its expected duration (a
+   negative time for no limit).  -r picks
+   the random number generator (see rng.h) and -c the transport's checksum
+   engine (see checksum.h).  congestion is the transport's congestion
+   control, CC_* of cc.h (0 none, 1 aimd, 2 vegas), and channel the
+   model of both directions of the channel, CHM_* of channel.h (0 iid,
+   1 gilbert, 2 bandwidth, 3 reorder) with its default parameters.
+   Every point draws from its own
+   stream of the base seed (stream number = point number), so
+   results do not depend on the number of threads or the order in which
+   points happen to run. */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include "emulator.h"
+#include "evqueue.h"
+#include "rng.h"
+#include "checksum.h"
+
+#define MAXVALUES 1024 /* values per grid axis */
+
+struct axis
+{
+  const char *key;
+  int nvalues;
+  double values[MAXVALUES];
+};
+
+/* the grid axes, in the order they vary (last one fastest) */
+#define AX_MESSAGES 0
+#define AX_LOSS 1
+#define AX_CORRUPT 2
+#define AX_DIRECTION 3
+#define AX_LAMBDA 4
+#define AX_WINDOW 5
+#define AX_DUPTHRESH 6
+#define AX_BIDIRECTIONAL 7
+#define AX_SENDQUEUE 8
+#define AX_COALESCE 9
+#define AX_CONGESTION 10
+#define AX_CHANNEL 11
+#define NAXES 12
+
+static struct axis axes[NAXES] = {
+    {"messages", 0, {0}},
+    {"loss", 0, {0}},
+    {"corrupt", 0, {0}},
+    {"direction", 0, {0}},
+    {"lambda", 0, {0}},
+    {"window", 0, {0}},
+    {"dupthresh", 0, {0}},
+    {"bidirectional", 0, {0}},
+    {"sendqueue", 0, {0}},
+    {"coalesce", 0, {0}},
+    {"congestion", 0, {0}},
+    {"channel", 0, {0}},
+};
+static const double axisdefault[NAXES] = {1000, 0.0, 0.0, 2, 10.0, 0, 0, 0, 0, 0, 0, 0};
+
+struct point
+{
+  struct sim_config cfg;
+  struct sim_stats stats;
+  int ok;
+};
+
+static struct point *points;
+static int npoints;
+static int nextpoint; /* next point for a worker to pick up */
+static pthread_mutex_t nextlock = PTHREAD_MUTEX_INITIALIZER;
+
+/* add the values in "list" (e.g. "0,0.1,0.5:1:0.25") to an axis */
+static int parsevalues(struct axis *ax, const char *list)
+{
+  char buf[256], *tok, *save;
+  double start, stop, step, v;
+  int n, k;
+
+  if (strlen(list) >= sizeof(buf))
+    return -1;
+  strcpy(buf, list);
+  for (tok = strtok_r(buf, ",", &save); tok != NULL; tok = strtok_r(NULL, ",", &save))
+  {
+    n = sscanf(tok, "%lf:%lf:%lf", &start, &stop, &step);
+    if (n == 1)
+      stop = start, step = 1.0;
+    else if (n != 3 || step <= 0.0)
+      return -1;
+    for (k = 0; (v = start + k * step) <= stop + step * 1e-9; k++)
+    {
+      if (ax->nvalues == MAXVALUES)
+        return -1;
+      ax->values[ax->nvalues++] = v;
+    }
+  }
+  return 0;
+}
+
+/* parse one "key=values" spec */
+static int parsespec(const char *spec)
+{
+  const char *eq = strchr(spec, '=');
+  int i;
+
+  if (eq == NULL)
+    return -1;
+  for (i = 0; i < NAXES; i++)
+    if (strlen(axes[i].key) == (size_t)(eq - spec) && strncmp(spec, axes[i].key, eq - spec) == 0)
+      return parsevalues(&axes[i], eq + 1);
+  return -1;
+}
+
+static int parsefile(const char *path)
+{
+  char line[512], *p, *q;
+  FILE *fp = fopen(path, "r");
+  int lineno = 0;
+
+  if (fp == NULL)
+  {
+    perror(path);
+    return -1;
+  }
+  while (fgets(line, sizeof(line), fp) != NULL)
+  {
+    lineno++;
+    if ((p = strchr(line, '#')) != NULL)
+      *p = '\0';
+    /* drop white space */
+    for (p = q = line; *p; p++)
+      if (*p != ' ' && *p != '\t' && *p != '\r' && *p != '\n')
+        *q++ = *p;
+    *q = '\0';
+    if (line[0] != '\0' && parsespec(line) != 0)
+    {
+      fprintf(stderr, "%s:%d: bad grid spec\n", path, lineno);
+      fclose(fp);
+      return -1;
+    }
+  }
+  fclose(fp);
+  return 0;
+}
+
+/* expand the axes into the list of points */
+static void makepoints(const struct sim_config *base)
+{
+  int i, k, rest;
+  double v[NAXES];
+
+  npoints = 1;
+  for (k = 0; k < NAXES; k++)
+  {
+    if (axes[k].nvalues == 0)
+      axes[k].values[axes[k].nvalues++] = axisdefault[k];
+    npoints *= axes[k].nvalues;
+  }
+  points = calloc(npoints, sizeof(struct point));
+  if (points == NULL)
+  {
+    fprintf(stderr, "memory allocation for sweep points failed.\n");
+    exit(EXIT_FAILURE);
+  }
+  for (i = 0; i < npoints; i++)
+  {
+    rest = i;
+    for (k = NAXES - 1; k >= 0; k--)
+    {
+      v[k] = axes[k].values[rest % axes[k].nvalues];
+      rest /= axes[k].nvalues;
+    }
+    points[i].cfg = *base;
+    points[i].cfg.nsimmax = (int)v[AX_MESSAGES];
+    points[i].cfg.lossprob = (float)v[AX_LOSS];
+    points[i].cfg.corruptprob = (float)v[AX_CORRUPT];
+    points[i].cfg.corruptdirection = (int)v[AX_DIRECTION];
+    points[i].cfg.lambda = (float)v[AX_LAMBDA];
+    points[i].cfg.windowsize = (int)v[AX_WINDOW];
+    points[i].cfg.dupthresh = (int)v[AX_DUPTHRESH];
+    points[i].cfg.bidirectional = (int)v[AX_BIDIRECTIONAL];
+    points[i].cfg.sendqueue = (int)v[AX_SENDQUEUE];
+    points[i].cfg.coalesce = (int)v[AX_COALESCE];
+    points[i].cfg.congestion = (int)v[AX_CONGESTION];
+    points[i].cfg.channel[A].model = (int)v[AX_CHANNEL];
+    points[i].cfg.channel[B].model = (int)v[AX_CHANNEL];
+    points[i].cfg.stream = i;
+  }
+}
+
+static void *worker(void *arg)
+{
+  struct sim *sim;
+  int i;
+
+  (void)arg;
+  for (;;)
+  {
+    pthread_mutex_lock(&nextlock);
+    i = nextpoint++;
+    pthread_mutex_unlock(&nextlock);
+    if (i >= npoints)
+      return NULL;
+    sim = sim_create(&points[i].cfg);
+    if (sim == NULL)
+      continue;
+    sim_run(sim);
+    points[i].stats = *sim_stats(sim);
+    points[i].ok = 1;
+    sim_destroy(sim);
+  }
+}
+
+/* messages per new data packet, of both entities */
+static double msgsperpacket(const struct sim_stats *st)
+{
+  int packets = st->datapackets[A] + st->datapackets[B];
+
+  return packets > 0 ? (double)(st->datamsgs[A] + st->datamsgs[B]) / packets : 0.0;
+}
+
+static void writecsv(FILE *fp)
+{
+  const struct point *p;
+  int i;
+
+  fprintf(fp, "point,messages,loss,corrupt,direction,lambda,window,dupthresh,bidirectional,"
+              "sendqueue,coalesce,congestion,channel,seed,stream,time,nsim,window_full,total_ACKs_received,new_ACKs,packets_resent,"
+              "spurious_resends,fast_retransmits,packets_received,messages_delivered,ntolayer3,"
+              "nlost,ncorrupt,acks_sent,piggybacked,goodput,retxratio,avgwindow,latency_mean,"
+              "latency_p50,latency_p99,latency_p999,latency_max,queued,avgqueue,peakqueue,"
+              "queuedelay_mean,queuedelay_p99,nevents,datapackets,msgs_per_packet,avgcwnd,reordered\n");
+  for (i = 0; i < npoints; i++)
+  {
+    p = &points[i];
+    if (!p->ok)
+      continue;
+    fprintf(fp, "%d,%d,%g,%g,%d,%g,%d,%d,%d,%d,%d,%d,%d,%llu,%llu,%f,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%d,%f,%f,%f,%f,%f,%f,%f,%f,%d,%f,%d,%f,%f,%lld,%d,%f,%f,%d\n",
+            i, p->cfg.nsimmax, p->cfg.lossprob, p->cfg.corruptprob, p->cfg.corruptdirection,
+            p->cfg.lambda, p->cfg.windowsize, p->cfg.dupthresh, p->cfg.bidirectional,
+            p->cfg.sendqueue, p->cfg.coalesce, p->cfg.congestion, p->cfg.channel[A].model, p->cfg.seed, p->cfg.stream, p->stats.time, p->stats.nsim, p->stats.window_full,
+            p->stats.total_ACKs_received, p->stats.new_ACKs, p->stats.packets_resent,
+            p->stats.spurious_resends, p->stats.fast_retransmits, p->stats.packets_received,
+            p->stats.messages_delivered, p->stats.ntolayer3, p->stats.nlost, p->stats.ncorrupt,
+            p->stats.acks_sent[A] + p->stats.acks_sent[B],
+            p->stats.piggybacked[A] + p->stats.piggybacked[B], p->stats.goodput,
+            p->stats.retxratio, p->stats.avgwindow[A], p->stats.latency[B].mean,
+            p->stats.latency[B].p50, p->stats.latency[B].p99, p->stats.latency[B].p999,
+            p->stats.latency[B].max, p->stats.queued[A], p->stats.avgqueue[A],
+            p->stats.peakqueue[A], p->stats.queuedelay[A].mean, p->stats.queuedelay[A].p99,
+            p->stats.nevents, p->stats.datapackets[A] + p->stats.datapackets[B],
+            msgsperpacket(&p->stats), p->stats.avgcwnd[A], p->stats.reordered);
+  }
+}
+
+static void writejson(FILE *fp)
+{
+  const struct point *p;
+  int i, first = 1;
+
+  fprintf(fp, "[\n");
+  for (i = 0; i < npoints; i++)
+  {
+    p = &points[i];
+    if (!p->ok)
+      continue;
+    fprintf(fp, "%s  {\"point\": %d, \"messages\": %d, \"loss\": %g, \"corrupt\": %g, "
+                "\"direction\": %d, \"lambda\": %g, \"window\": %d, \"dupthresh\": %d, "
+                "\"bidirectional\": %d, \"sendqueue\": %d, \"coalesce\": %d, \"congestion\": %d, \"channel\": %d, \"seed\": %llu, \"stream\": %llu, \"time\": %f, \"nsim\": %d, "
+                "\"window_full\": %d, \"total_ACKs_received\": %d, \"new_ACKs\": %d, "
+                "\"packets_resent\": %d, \"spurious_resends\": %d, \"fast_retransmits\": %d, "
+                "\"packets_received\": %d, \"messages_delivered\": %d, "
+                "\"ntolayer3\": %d, \"nlost\": %d, \"ncorrupt\": %d, \"acks_sent\": %d, "
+                "\"piggybacked\": %d, \"goodput\": %f, "
+                "\"retxratio\": %f, \"avgwindow\": %f, \"latency_mean\": %f, \"latency_p50\": %f, "
+                "\"latency_p99\": %f, \"latency_p999\": %f, \"latency_max\": %f, \"queued\": %d, "
+                "\"avgqueue\": %f, \"peakqueue\": %d, \"queuedelay_mean\": %f, \"queuedelay_p99\": %f, "
+                "\"nevents\": %lld, \"datapackets\": %d, \"msgs_per_packet\": %f, \"avgcwnd\": %f, \"reordered\": %d}",
+            first ? "" : ",\n", i, p->cfg.nsimmax, p->cfg.lossprob, p->cfg.corruptprob,
+            p->cfg.corruptdirection, p->cfg.lambda, p->cfg.windowsize, p->cfg.dupthresh,
+            p->cfg.bidirectional, p->cfg.sendqueue, p->cfg.coalesce, p->cfg.congestion,
+            p->cfg.channel[A].model, p->cfg.seed, p->cfg.stream, p->stats.time,
+            p->stats.nsim,
+            p->stats.window_full, p->stats.total_ACKs_received, p->stats.new_ACKs,
+            p->stats.packets_resent, p->stats.spurious_resends, p->stats.fast_retransmits,
+            p->stats.packets_received, p->stats.messages_delivered,
+            p->stats.ntolayer3, p->stats.nlost, p->stats.ncorrupt,
+            p->stats.acks_sent[A] + p->stats.acks_sent[B],
+            p->stats.piggybacked[A] + p->stats.piggybacked[B], p->stats.goodput,
+            p->stats.retxratio, p->stats.avgwindow[A], p->stats.latency[B].mean,
+            p->stats.latency[B].p50, p->stats.latency[B].p99, p->stats.latency[B].p999,
+            p->stats.latency[B].max, p->stats.queued[A], p->stats.avgqueue[A],
+            p->stats.peakqueue[A], p->stats.queuedelay[A].mean, p->stats.queuedelay[A].p99,
+            p->stats.nevents, p->stats.datapackets[A] + p->stats.datapackets[B],
+            msgsperpacket(&p->stats), p->stats.avgcwnd[A], p->stats.reordered);
+    first = 0;
+  }
+  fprintf(fp, "\n]\n");
+}
+
+static void usage(const char *prog)
+{
+  fprintf(stderr, "usage: %s [-j threads] [-f csv|json] [-o file] [-s seed] [-r rng] [-q engine] [-c checksum] [-t maxtime] [-g key=values]... [gridfile]\n", prog);
+  fprintf(stderr, "keys: messages loss corrupt direction lambda window dupthresh bidirectional sendqueue coalesce congestion channel\n"
+                  "(0 for the protocol default)\n");
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+  struct sim_config base;
+  pthread_t *threads;
+  struct timeval t0, t1;
+  const char *outpath = NULL, *why;
+  int nthreads, json = 0, i, opt, err = 0;
+  FILE *out;
+
+  sim_defaults(&base);
+  base.trace = 0;
+  nthreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  while ((opt = getopt(argc, argv, "j:f:o:s:r:q:c:t:g:")) != -1)
+  {
+    switch (opt)
+    {
+    case 'j':
+      nthreads = atoi(optarg);
+      break;
+    case 'f':
+      if (strcmp(optarg, "json") == 0)
+        json = 1;
+      else if (strcmp(optarg, "csv") != 0)
+        usage(argv[0]);
+      break;
+    case 'o':
+      outpath = optarg;
+      break;
+    case 's':
+      base.seed = strtoull(optarg, NULL, 0);
+      break;
+    case 'r':
+      if ((base.rng = rng_kind(optarg)) < 0)
+        usage(argv[0]);
+      break;
+    case 'q':
+      if ((base.evqengine = evq_engine(optarg)) < 0)
+        usage(argv[0]);
+      break;
+    case 'c':
+      if ((base.checksum = checksum_engine(optarg)) < 0)
+        usage(argv[0]);
+      break;
+    case 't':
+      base.maxtime = atof(optarg);
+      break;
+    case 'g':
+      if (parsespec(optarg) != 0)
+      {
+        fprintf(stderr, "bad grid spec: %s\n", optarg);
+        usage(argv[0]);
+      }
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  for (i = optind; i < argc; i++)
+    if (parsefile(argv[i]) != 0)
+      return EXIT_FAILURE;
+  if (nthreads < 1)
+    nthreads = 1;
+
+  makepoints(&base);
+  if (nthreads > npoints)
+    nthreads = npoints;
+  threads = malloc(nthreads * sizeof(pthread_t));
+  if (threads == NULL)
+  {
+    fprintf(stderr, "memory allocation for threads failed.\n");
+    return EXIT_FAILURE;
+  }
+
+  gettimeofday(&t0, NULL);
+  for (i = 0; i < nthreads; i++)
+    if ((err = pthread_create(&threads[i], NULL, worker, NULL)) != 0)
+      break;
+  if (i == 0)
+  {
+    fprintf(stderr, "could not start a thread: %s\n", strerror(err));
+    return EXIT_FAILURE;
+  }
+  if (i < nthreads)
+  { /* the threads already started share out the points between them */
+    fprintf(stderr, "started only %d of %d threads: %s\n", i, nthreads, strerror(err));
+    nthreads = i;
+  }
+  for (i = 0; i < nthreads; i++)
+    pthread_join(threads[i], NULL);
+  gettimeofday(&t1, NULL);
+  fprintf(stderr, "%d points on %d threads in %.3f s\n", npoints, nthreads,
+          (t1.tv_sec - t0.tv_sec) + (t1.tv_usec - t0.tv_usec) / 1e6);
+  for (i = 0; i < npoints; i++)
+    if (!points[i].ok)
+    {
+      why = sim_checkconfig(&points[i].cfg);
+      fprintf(stderr, "point %d skipped: %s\n", i, why != NULL ? why : "the run could not be set up");
+    }
+
+  out = stdout;
+  if (outpath != NULL && (out = fopen(outpath, "w")) == NULL)
+  {
+    perror(outpath);
+    return EXIT_FAILURE;
+  }
+  if (json)
+    writejson(out);
+  else
+    writecsv(out);
+  if (out != stdout)
+    fclose(out);
+  free(threads);
+  free(points);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,172 @@
+/* Trace ring buffer and the text formats of the trace records.
+
+   In a format, %T and %V print the record's time and value, %S, %K, %C
+   and %E its seq, ack, check and entity, %N the entity as A or B and %D
+   the 20 data characters, or their 40 hex digits if any is not printable
+   (such as the SACK bitmap of an ACK). */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include "trace.h"
+
+const struct trace_type trace_types[TR_NTYPES] = {
+    /* TR_INSERTEVENT */ {3, "            INSERTEVENT: time is %T\n            INSERTEVENT: future time will be %V\n"},
+    /* TR_ARRIVAL */ {3, "          GENERATE NEXT ARRIVAL: creating new arrival\n"},
+    /* TR_EVENT + 0 */ {2, "\nEVENT time: %T,  type: 0, timerinterrupt   entity: %E\n"},
+    /* TR_EVENT + 1 */ {2, "\nEVENT time: %T,  type: 1, fromlayer5  entity: %E\n"},
+    /* TR_EVENT + 2 */ {2, "\nEVENT time: %T,  type: 2, fromlayer3  entity: %E\n"},
+    /* TR_MAINLOOP */ {3, "          MAINLOOP: data given to student: %D\n"},
+    /* TR_NOMORE */ {3, "          FROM_LAYER5: no more messages to send: \n"},
+    /* TR_STOPTIMER */ {2, "          STOP TIMER: stopping timer at %T\n"},
+    /* TR_STARTTIMER */ {2, "          START TIMER: starting timer at %T\n"},
+    /* TR_LOST */ {1, "          TOLAYER3: packet being lost\n"},
+    /* TR_TOLAYER3 */ {3, "          TOLAYER3: seq: %S, ack %K, check: %C %D\n"},
+    /* TR_CORRUPT */ {1, "          TOLAYER3: packet being corrupted\n"},
+    /* TR_SCHEDULE */ {3, "          TOLAYER3: scheduling arrival on other side\n"},
+    /* TR_TOLAYER5 */ {3, "          TOLAYER5: data received by application at %N: %D\n"},
+    /* TR_A_SEND */ {2, "----%N: New message arrives, send window is not full, send new messge to layer3!\n"},
+    /* TR_A_SENDING */ {1, "Sending packet %S to layer 3\n"},
+    /* TR_A_FULL */ {1, "----%N: New message arrives, send window is full\n"},
+    /* TR_A_ACK */ {1, "----%N: uncorrupted ACK %K is received\n"},
+    /* TR_A_NEWACK */ {1, "----%N: ACK %K is not a duplicate\n"},
+    /* TR_A_DUPACK */ {1, "----%N: duplicate ACK received, do nothing!\n"},
+    /* TR_A_BADACK */ {1, "----%N: corrupted ACK is received, do nothing!\n"},
+    /* TR_A_TIMEOUT */ {1, "----%N: time out,resend packets!\n---%N: resending packet %S\n"},
+    /* TR_B_RECV */ {1, "----%N: packet %S is correctly received, send ACK!\n"},
+    /* TR_A_FASTRETX */ {1, "----%N: later packets ACKed, fast retransmit!\n---%N: resending packet %S\n"},
+    /* TR_A_QUEUED */ {1, "----%N: New message arrives, send window is full, queue it\n"},
+    /* TR_A_HOLD */ {1, "----%N: New message arrives, hold it to share a packet with the next ones\n"},
+    /* TR_A_CWND */ {2, "          CWND: congestion window of %N is %V at %T, %S packets in flight\n"},
+};
+
+/* the data characters, as hex digits unless all of them are printable */
+static void printdata(FILE *fp, const char *data, int len)
+{
+  int i;
+
+  for (i = 0; i < len && isprint((unsigned char)data[i]); i++)
+    ;
+  if (i == len)
+  {
+    fwrite(data, 1, len, fp);
+    return;
+  }
+  for (i = 0; i < len; i++)
+    fprintf(fp, "%02x", (unsigned char)data[i]);
+}
+
+void trace_print(FILE *fp, const struct trace_rec *r)
+{
+  const char *f;
+
+  if (r->type >= TR_NTYPES)
+  {
+    fprintf(fp, "unknown trace record type %d\n", r->type);
+    return;
+  }
+  for (f = trace_types[r->type].fmt; *f; f++)
+  {
+    if (*f != '%')
+    {
+      putc(*f, fp);
+      continue;
+    }
+    switch (*++f)
+    {
+    case 'T':
+      fprintf(fp, "%f", r->time);
+      break;
+    case 'V':
+      fprintf(fp, "%f", r->value);
+      break;
+    case 'S':
+      fprintf(fp, "%d", r->seq);
+      break;
+    case 'K':
+      fprintf(fp, "%d", r->ack);
+      break;
+    case 'C':
+      fprintf(fp, "%d", r->check);
+      break;
+    case 'E':
+      fprintf(fp, "%d", r->entity);
+      break;
+    case 'N':
+      putc(r->entity == 0 ? 'A' : 'B', fp);
+      break;
+    case 'D':
+      printdata(fp, r->data, sizeof(r->data));
+      break;
+    default:
+      putc(*f, fp);
+    }
+  }
+}
+
+void trace_init(struct tracebuf *t, int cap)
+{
+  memset(t, 0, sizeof(*t));
+  if (cap < 1)
+    cap = 1;
+  t->recs = malloc(cap * sizeof(struct trace_rec));
+  if (t->recs == NULL)
+  {
+    printf("memory allocation for trace buffer failed.");
+    exit(EXIT_FAILURE);
+  }
+  t->cap = cap;
+}
+
+void trace_free(struct tracebuf *t)
+{
+  trace_flush(t);
+  free(t->recs);
+  t->recs = NULL;
+}
+
+void trace_setsink(struct tracebuf *t, FILE *fp, int binary)
+{
+  t->sink = fp;
+  t->binary = binary;
+  if (fp != NULL && binary)
+    fwrite(TRACE_MAGIC, 1, strlen(TRACE_MAGIC), fp);
+}
+
+void trace_flush(struct tracebuf *t)
+{
+  int i, n;
+
+  if (t->sink == NULL)
+    return;
+  while (t->count > 0)
+  {
+    /* the records up to the end of the array, or all of them */
+    n = t->cap - t->first;
+    if (n > t->count)
+      n = t->count;
+    if (t->binary)
+      fwrite(&t->recs[t->first], sizeof(struct trace_rec), n, t->sink);
+    else
+      for (i = 0; i < n; i++)
+        trace_print(t->sink, &t->recs[t->first + i]);
+    t->first = (t->first + n) % t->cap;
+    t->count -= n;
+  }
+}
+
+void trace_put(struct tracebuf *t, const struct trace_rec *r)
+{
+  if (t->count == t->cap)
+  {
+    if (t->sink != NULL)
+      trace_flush(t);
+    else
+    { /* drop the oldest record */
+      t->first = (t->first + 1) % t->cap;
+      t->count--;
+    }
+  }
+  t->recs[(t->first + t->count) % t->cap] = *r;
+  t->count++;
+}
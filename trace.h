@@ -0,0 +1,111 @@
+/* Binary tracing for the emulator and the transport protocol.
+
+   A trace point stores one fixed-size record in the sim's ring buffer
+   instead of calling printf.  When the ring fills up it is flushed to the
+   sim's trace sink, either as raw records (read back later by tracedecode)
+   or formatted as the emulator's usual human-readable trace.  With no sink
+   the ring simply keeps the most recent records.
+
+   Building with -DNTRACE removes every trace point from the code. */
+#include <stdio.h>
+#include <stdint.h>
+
+/* record types; trace_types[] in trace.c gives each one its TRACE level */
+/* and its text format */
+/* (TR_A_* are taken by the sender and TR_B_* by the receiver, at either */
+/* entity in a bidirectional run) */
+#define TR_INSERTEVENT 0
+#define TR_ARRIVAL 1
+#define TR_EVENT 2 /* TR_EVENT + evtype */
+#define TR_MAINLOOP 5
+#define TR_NOMORE 6
+#define TR_STOPTIMER 7
+#define TR_STARTTIMER 8
+#define TR_LOST 9
+#define TR_TOLAYER3 10
+#define TR_CORRUPT 11
+#define TR_SCHEDULE 12
+#define TR_TOLAYER5 13
+#define TR_A_SEND 14
+#define TR_A_SENDING 15
+#define TR_A_FULL 16
+#define TR_A_ACK 17
+#define TR_A_NEWACK 18
+#define TR_A_DUPACK 19
+#define TR_A_BADACK 20
+#define TR_A_TIMEOUT 21
+#define TR_B_RECV 22
+#define TR_A_FASTRETX 23
+#define TR_A_QUEUED 24
+#define TR_A_HOLD 25
+#define TR_A_CWND 26
+#define TR_NTYPES 27
+
+struct trace_rec
+{
+  double time;   /* simulated time of the trace point */
+  double value;  /* another time, e.g. when an inserted event will happen */
+  int32_t seq;
+  int32_t ack;
+  int32_t check;
+  uint16_t type;
+  int16_t entity;
+  char data[20]; /* payload or message data, if any */
+};
+
+struct trace_type
+{
+  int level;       /* lowest TRACE at which the record is taken */
+  const char *fmt; /* text format, see trace_print() */
+};
+
+extern const struct trace_type trace_types[TR_NTYPES];
+
+/* a ring of records plus where to flush it */
+struct tracebuf
+{
+  struct trace_rec *recs;
+  int cap;     /* capacity in records */
+  int first;   /* oldest record */
+  int count;   /* records held */
+  FILE *sink;  /* flush target, or NULL to keep only the latest records */
+  int binary;  /* write raw records rather than text to the sink */
+};
+
+#define TRACE_MAGIC "SRTRACE1" /* start of a binary trace file */
+
+extern void trace_init(struct tracebuf *, int cap);
+extern void trace_free(struct tracebuf *);
+extern void trace_setsink(struct tracebuf *, FILE *, int binary);
+extern void trace_put(struct tracebuf *, const struct trace_rec *);
+extern void trace_flush(struct tracebuf *);
+
+/* print one record in the emulator's human-readable trace format */
+extern void trace_print(FILE *, const struct trace_rec *);
+
+/* the trace of a sim (see emulator.h) */
+struct sim;
+
+/* where the sim's trace records go: written raw to fp if binary is set, */
+/* printed as text otherwise, or with fp NULL only the most recent ones  */
+/* are kept.  Records taken so far go to the new sink straight away.      */
+extern void sim_tracesink(struct sim *, FILE *fp, int binary);
+
+/* write out the records held by the sim's ring */
+extern void sim_traceflush(struct sim *);
+
+/* take one record; use TRACEPOINT, which skips this at lower TRACE levels */
+extern void sim_tracepoint(struct sim *, int type, int entity, int seq, int ack,
+                           int check, double value, const char *data);
+
+/* a trace point: sim, record type, then the record fields (data may be NULL) */
+#ifdef NTRACE
+#define TRACEPOINT(sim, type, entity, seq, ack, check, value, data) ((void)0)
+#else
+#define TRACEPOINT(sim, type, entity, seq, ack, check, value, data)          \
+  do                                                                         \
+  {                                                                          \
+    if (sim_trace(sim) >= trace_types[type].level)                           \
+      sim_tracepoint(sim, type, entity, seq, ack, check, value, data);       \
+  } while (0)
+#endif
@@ -0,0 +1,53 @@
+/* Offline decoder of binary emulator traces: prints the records of a trace
+   file written with "-T file" in the emulator's human-readable format.
+
+   usage: tracedecode [-l level] [tracefile]
+
+   -l prints only the records that the given TRACE level would have shown
+   (by default every record in the file).  With no file the trace is read
+   from standard input. */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "trace.h"
+
+int main(int argc, char **argv)
+{
+  struct trace_rec rec;
+  char magic[sizeof(TRACE_MAGIC) - 1];
+  int level = 1 << 30;
+  FILE *fp = stdin;
+  int i;
+
+  for (i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "-l") == 0 && i + 1 < argc)
+      level = atoi(argv[++i]);
+    else if (argv[i][0] != '-' && fp == stdin)
+    {
+      if ((fp = fopen(argv[i], "rb")) == NULL)
+      {
+        perror(argv[i]);
+        return EXIT_FAILURE;
+      }
+    }
+    else
+    {
+      fprintf(stderr, "usage: %s [-l level] [tracefile]\n", argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (fread(magic, 1, sizeof(magic), fp) != sizeof(magic) ||
+      memcmp(magic, TRACE_MAGIC, sizeof(magic)) != 0)
+  {
+    fprintf(stderr, "not an emulator trace file\n");
+    return EXIT_FAILURE;
+  }
+  while (fread(&rec, sizeof(rec), 1, fp) == 1)
+    if (rec.type >= TR_NTYPES || trace_types[rec.type].level <= level)
+      trace_print(stdout, &rec);
+  if (fp != stdin)
+    fclose(fp);
+  return EXIT_SUCCESS;
+}